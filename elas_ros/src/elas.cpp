@@ -151,6 +151,10 @@ public:
 #endif
     UPDATE_PARAM(disp_min);
     UPDATE_PARAM(disp_max);
+    if (param_.disp_max<param_.disp_min) {
+      ROS_WARN_STREAM("disp_max " << param_.disp_max << " is below disp_min, using " << param_.disp_min);
+      param_.disp_max = param_.disp_min;
+    }
     UPDATE_PARAM(support_threshold);
     UPDATE_PARAM(support_texture);
     UPDATE_PARAM(candidate_stepsize);
@@ -172,6 +176,11 @@ public:
     UPDATE_PARAM(filter_adaptive_mean);
     UPDATE_PARAM(postprocess_only_left);
     UPDATE_PARAM(subsampling);
+    UPDATE_PARAM(subsampling_step);
+    UPDATE_PARAM(incremental_triangulation);
+    UPDATE_PARAM(lattice_triangulation);
+    UPDATE_PARAM(lr_from_left);
+    UPDATE_PARAM(plane_fill_threshold);
   }
 
   bool doApproxSync() const {
@@ -389,7 +398,7 @@ public:
           int index = v*l_width + u;
           data.disparity[index] = l_disp_data[index];
 #ifdef DOWN_SAMPLE
-          cv::Vec3b col = cv_ptr->image.at<cv::Vec3b>(v*2,u*2);
+          cv::Vec3b col = cv_ptr->image.at<cv::Vec3b>(v*param_.subsampling_step,u*param_.subsampling_step);
 #else
           cv::Vec3b col = cv_ptr->image.at<cv::Vec3b>(v,u);
 #endif
@@ -404,8 +413,8 @@ public:
         cv::Point2d left_uv;
         int32_t index = inliers[i];
 #ifdef DOWN_SAMPLE
-        left_uv.x = (index % l_width) * 2;
-        left_uv.y = (index / l_width) * 2;
+        left_uv.x = (index % l_width) * param_.subsampling_step;
+        left_uv.y = (index / l_width) * param_.subsampling_step;
 #else
         left_uv.x = index % l_width;
         left_uv.y = index / l_width;
@@ -649,8 +658,8 @@ public:
     ROS_ASSERT(l_image_msg->height == r_image_msg->height);
 
 #ifdef DOWN_SAMPLE
-    int32_t width = l_image_msg->width/2;
-    int32_t height = l_image_msg->height/2;
+    int32_t width = l_image_msg->width/param_.subsampling_step;
+    int32_t height = l_image_msg->height/param_.subsampling_step;
 #else
     int32_t width = l_image_msg->width;
     int32_t height = l_image_msg->height;
@@ -0,0 +1,155 @@
+/*
+This file is part of libelas.
+
+libelas is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or any later version.
+
+libelas is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+libelas; if not, write to the Free Software Foundation, Inc., 51 Franklin
+Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+// Incremental Delaunay triangulation (Bowyer-Watson insertion, Lawson
+// flips after vertex motion and star re-triangulation for removal).
+// Unlike Triangle, the triangulation is kept alive between calls, so a
+// caller can update it with a few new, moved or removed points instead
+// of re-triangulating the whole point set.
+//
+// Points have integer coordinates and all predicates are evaluated
+// exactly, so the result does not depend on round-off. The points live
+// inside a large square frame of four auxiliary vertices; triangles
+// touching the frame are not reported, which only drops degenerate
+// slivers along the convex hull.
+
+#ifndef __DELAUNAY_H__
+#define __DELAUNAY_H__
+
+#include <vector>
+
+// define fixed-width datatypes for Visual Studio projects
+#ifndef _MSC_VER
+  #include <stdint.h>
+#else
+  typedef __int32           int32_t;
+  typedef __int64           int64_t;
+#endif
+
+class Delaunay {
+
+public:
+
+  Delaunay () { reset(); }
+
+  // coordinates must lie strictly within (-frame_size,frame_size)
+  static const int32_t frame_size = 1<<28;
+
+  // start an empty triangulation
+  void reset ();
+
+  // true if (x,y) lies strictly inside the frame
+  bool insideFrame (int32_t x,int32_t y) const {
+    return x>-frame_size && x<frame_size && y>-frame_size && y<frame_size;
+  }
+
+  // insert a point, returns its vertex handle or -1 if a vertex already
+  // exists at this position (or the point is outside the frame). The
+  // optional hint is a nearby vertex to start the point location from.
+  // If point location fails, the triangulation is rebuilt from scratch.
+  int32_t insert (int32_t x,int32_t y,int32_t hint=-1);
+
+  // re-triangulate all vertices from scratch, keeping their handles
+  void rebuild ();
+
+  // triangulate points on a regular lattice (coordinates are non-negative
+  // multiples of step) in linear time: consecutive rows are zipped
+  // together, concave pockets along the sides are filled and the result is
+  // made Delaunay by edge flips. handle[i] receives the vertex of point i
+  // (-1 for duplicates). Returns false (and leaves the triangulation empty)
+  // if a point is off the lattice or all points are collinear.
+  bool buildLattice (const std::vector<int32_t> &x,const std::vector<int32_t> &y,int32_t step,
+                     std::vector<int32_t> &handle);
+
+  // remove a vertex and re-triangulate its star
+  void remove (int32_t vtx);
+
+  // move a vertex without changing connectivity; call legalize() once all
+  // moves are done. Returns false (and leaves the vertex in place) if a
+  // triangle around it would be inverted; such a vertex has to be removed
+  // and re-inserted after legalize(). A vertex which keeps its position
+  // is left untouched.
+  bool move (int32_t vtx,int32_t x,int32_t y);
+
+  // restore the Delaunay property around all vertices moved since the
+  // last call by edge flips
+  void legalize ();
+
+  // number of vertex handles in use (frame vertices included)
+  int32_t numVertexHandles () const { return vtx.size(); }
+
+  // true if the handle refers to a live, non-frame vertex
+  bool isVertex (int32_t v) const { return v>=4 && v<(int32_t)vtx.size() && vtx[v].tri>=0; }
+
+  // triangles not touching the frame, as vertex handle triplets (ccw)
+  void getTriangles (std::vector<int32_t> &corners) const;
+
+private:
+
+  struct vertex {
+    int32_t x,y;
+    int32_t tri;     // one incident triangle, -1 if the handle is free
+  };
+
+  struct tri {
+    int32_t v[3];    // corners in counter-clockwise order, v[0]=-1 if free
+    int32_t n[3];    // n[i]: neighbor across the edge opposite v[i], -1 if none
+  };
+
+  int64_t orient   (int32_t a,int32_t b,int32_t x,int32_t y) const;
+  int32_t incircle (int32_t t,int32_t x,int32_t y) const;
+  int32_t locate   (int32_t x,int32_t y,int32_t hint) const;
+  int32_t newVertex   (int32_t x,int32_t y);
+  int32_t newTriangle (int32_t a,int32_t b,int32_t c);
+  void    insertVertex (int32_t p,int32_t t);
+  void    freeTriangle (int32_t t);
+  void    setNeighbor  (int32_t t,int32_t a,int32_t b,int32_t nb);
+  void    link         (int32_t t,int32_t a,int32_t b,int32_t nb);
+  void    flip         (int32_t t,int32_t i);
+  void    legalizeEdge (int32_t t,int32_t i);
+  void    flipQueued   ();
+  int32_t sideTriangle (int32_t code) const;
+  void    linkSide     (int32_t t,int32_t a,int32_t b,int32_t code);
+
+  std::vector<vertex>  vtx;
+  std::vector<tri>     tris;
+  std::vector<int32_t> free_vtx;
+  std::vector<int32_t> free_tris;
+  int32_t              last_tri;
+
+  // scratch buffers, kept to avoid reallocation
+  std::vector<int32_t> cavity;
+  std::vector<int32_t> boundary;
+  std::vector<int32_t> start_tri;
+  std::vector<int32_t> ring;
+  std::vector<int32_t> ring_nb;
+  std::vector<int32_t> moved;
+  std::vector<int32_t> flip_stack;
+  std::vector<int32_t> rebuild_vtx;
+
+  // scratch buffers of buildLattice()
+  std::vector<int32_t> lattice_count;
+  std::vector<int32_t> lattice_order;
+  std::vector<int32_t> row_first;
+  std::vector<int32_t> row_tri;
+  std::vector<int32_t> strip_tri;
+  std::vector<int32_t> side_stack;
+  std::vector<int32_t> side_edge;
+  std::vector<int32_t> hull_vtx;
+  std::vector<int32_t> hull_tri;
+};
+
+#endif
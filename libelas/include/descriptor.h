@@ -50,8 +50,9 @@ class Descriptor {
   
 public:
   
-  // constructor creates filters
-  Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution);
+  // constructor creates filters, only every step-th row is computed and
+  // stored (image row v at descriptor row v/step)
+  Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,int32_t step);
   
   // deconstructor releases memory
   ~Descriptor();
@@ -62,7 +63,7 @@ public:
 private:
 
   // build descriptor I_desc from I_du and I_dv
-  void createDescriptor(uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,bool half_resolution);
+  void createDescriptor(uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,int32_t step);
 
 };
 
@@ -30,7 +30,8 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include <stdlib.h>
 #include <vector>
 #include <emmintrin.h>
-#include "matrix.h"
+#include "matrix33.h"
+#include "delaunay.h"
 
 #define PROFILE
 
@@ -52,6 +53,9 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include "timer.h"
 #endif
 
+// persistent triangulation state of Triangle (see triangle.h)
+struct triangulatecontext;
+
 class Elas {
   
 public:
@@ -60,9 +64,10 @@ public:
   
   // parameter settings
   struct parameters {
-    int32_t disp_min;               // min disparity
+    int32_t disp_min;               // min disparity (grids and priors start here)
     int32_t disp_max;               // max disparity
-    float   support_threshold;      // max. uniqueness ratio (best vs. second best support match)
+    float   support_threshold;      // max. uniqueness ratio (best vs. second best support match
+                                    // and right pixel claimed via lr_from_left)
     int32_t support_texture;        // min texture for support points
     int32_t candidate_stepsize;     // step size of regular grid on which support points are matched
     int32_t incon_window_size;      // window size of inconsistent support point check
@@ -82,9 +87,21 @@ public:
     bool    filter_median;          // optional median filter (approximated)
     bool    filter_adaptive_mean;   // optional adaptive mean filter (approximated)
     bool    postprocess_only_left;  // saves time by not postprocessing the right image
-    bool    subsampling;            // saves time by only computing disparities for each 2nd pixel
+    bool    subsampling;            // saves time by only computing disparities for each n-th pixel
                                     // note: for this option D1 and D2 must be passed with size
-                                    //       width/2 x height/2 (rounded towards zero)
+                                    //       width/n x height/n (rounded towards zero)
+    int32_t subsampling_step;       // n, the output stride used if subsampling is set
+    bool    incremental_triangulation; // update the previous frame's triangulation (matched by
+                                       // support point id) instead of re-triangulating all points
+    bool    lattice_triangulation;  // triangulate left support points on the candidate lattice in
+                                    // linear time instead of calling Triangle (cocircular lattice
+                                    // squares may be split differently)
+    bool    lr_from_left;           // derive the right disparities for the L/R check from the left
+                                    // matching costs instead of matching the right image
+                                    // (only used together with postprocess_only_left)
+    float   plane_fill_threshold;   // fill low-texture triangles by plane interpolation instead of
+                                    // matching if the far corners of all neighbours are this close
+                                    // to the plane (0=off)
     
     // constructor
     parameters (setting s=ROBOTICS) {
@@ -116,6 +133,11 @@ public:
         filter_adaptive_mean  = 1;
         postprocess_only_left = 1;
         subsampling           = 0;
+        subsampling_step      = 2;
+        incremental_triangulation = 0;
+        lattice_triangulation = 0;
+        lr_from_left          = 0;
+        plane_fill_threshold  = 0;
         
       // default settings for middlebury benchmark
       // (interpolate all missing disparities)
@@ -143,6 +165,11 @@ public:
         filter_adaptive_mean  = 0;
         postprocess_only_left = 0;
         subsampling           = 0;
+        subsampling_step      = 2;
+        incremental_triangulation = 0;
+        lattice_triangulation = 0;
+        lr_from_left          = 0;
+        plane_fill_threshold  = 0;
       }
     }
   };
@@ -150,7 +177,7 @@ public:
   // constructor, input: parameters  
   Elas(parameters param = parameters());
   // deconstructor
-  ~Elas () {}
+  ~Elas ();
   
   // matching function
   // inputs: pointers to left (I1) and right (I2) intensity image (uint8, input)
@@ -160,9 +187,15 @@ public:
   //         dims[2] = bytes per line (often equal to width, but allowed to differ)
   //         note: D1 and D2 must be allocated before (bytes per line = width)
   //               if subsampling is not active their size is width x height,
-  //               otherwise width/2 x height/2 (rounded towards zero)
+  //               otherwise width/n x height/n with n = subsampling_step
+  //               (rounded towards zero)
   void process (uint8_t* I1,uint8_t* I2,float* D1,float* D2,const int32_t* dims);
 
+  // same, but the disparities are written as int16 in 1/16 pixels
+  // (invalid pixels are set to disp16_invalid)
+  void process (uint8_t* I1,uint8_t* I2,int16_t* D1,int16_t* D2,const int32_t* dims);
+  static const int16_t disp16_invalid = -160;
+
   struct support_pt {
     int32_t u;
     int32_t v;
@@ -173,16 +206,34 @@ public:
 
   struct triangle {
     int32_t c1,c2,c3;
-    float   t1a,t1b,t1c;
-    float   t2a,t2b,t2c;
-    Matrix  Ainv;
+    Matrix33 Ainv;    // inverse of the [u v 1]' corner matrix (barycentric weights)
     triangle(int32_t c1,int32_t c2,int32_t c3):c1(c1),c2(c2),c3(c3){}
   };
 
+  // corners and disparity planes of a triangle list, one entry per triangle
+  // (all the dense matching stage reads, built once per frame)
+  struct triangle_table {
+    std::vector<int32_t> u1,u2,u3;    // corner u (left image)
+    std::vector<int32_t> v1,v2,v3;    // corner v
+    std::vector<int32_t> d1,d2,d3;    // corner disparity
+    std::vector<float> t1a,t1b,t1c;   // left image:  d = t1a*u+t1b*v+t1c
+    std::vector<float> t2a,t2b,t2c;   // right image: d = t2a*u+t2b*v+t2c
+    std::vector<uint8_t> planar;      // filled by plane interpolation
+    int32_t size () const { return t1a.size(); }
+  };
+
+  // disparity candidates of all grid cells (relative to disp_min), the
+  // candidates of cell c are cand[offset[c]] .. cand[offset[c+1]-1]
+  struct disparity_grid {
+    std::vector<uint32_t> offset;
+    std::vector<uint8_t>  cand8;      // used if there are at most 256 disparities
+    std::vector<uint16_t> cand16;     // used otherwise
+  };
+
   struct sparse_triangle {
     int     cidx[3];  // current local index of corner points
     int64_t c[3];     // id of corner points
-    Matrix  Ainv;
+    Matrix33 Ainv;    // inverse of the [u v 1]' corner matrix (barycentric weights)
     sparse_triangle(const int *cidx_a, const int64_t *c_a) {
       memcpy(cidx, cidx_a, sizeof(cidx));
       memcpy(c, c_a, sizeof(c));
@@ -211,6 +262,29 @@ private:
   inline uint32_t getAddressOffsetGrid (const int32_t& x,const int32_t& y,const int32_t& d,const int32_t& width,const int32_t& disp_num) {
     return (y*width+x)*disp_num+d;
   }
+
+  // disparity units per pixel of a disparity image format
+  static inline int32_t disparityScale (const float*)   { return 1; }
+  static inline int32_t disparityScale (const int16_t*) { return 16; }
+
+  // output stride (1 if subsampling is not active), descriptors and
+  // disparity images only hold every step-th row and column
+  inline int32_t subsamplingStep () const {
+    return param.subsampling && param.subsampling_step>1 ? param.subsampling_step : 1;
+  }
+
+  // minimum segment size of the speckle filter in output pixels
+  int32_t speckleSize () const;
+
+  // maximum gap width of the gap interpolation in output pixels
+  int32_t ipolGapWidth () const;
+
+  // support point lattice step, rounded up to a multiple of the output
+  // stride, so that support matching only needs computed descriptor rows
+  inline int32_t candidateStepsize () const {
+    int32_t step = subsamplingStep();
+    return (param.candidate_stepsize+step-1)/step*step;
+  }
   void print_exist_grid(const int32_t *grid);
   
   // support point functions
@@ -224,9 +298,16 @@ private:
                                                  const std::vector<support_pt> &pt, const std::vector<sparse_triangle> &oldtri);
 
   // triangulation & grid
-  std::vector<triangle> computeDelaunayTriangulation (const std::vector<support_pt> &p_support,int32_t right_image);
-  void computeDisparityPlanes (std::vector<support_pt> p_support,std::vector<triangle> &tri,int32_t right_image);
-  void createGrid (std::vector<support_pt> p_support,int32_t* disparity_grid,int32_t* grid_dims,bool right_image);
+  void computeDelaunayTriangulation (const std::vector<support_pt> &p_support,int32_t right_image,std::vector<triangle> &tri);
+  bool computeLatticeTriangulation (const std::vector<support_pt> &p_support,std::vector<triangle> &tri);
+  void computeIncrementalTriangulation (const std::vector<support_pt> &p_support,std::vector<triangle> &tri);
+  void computeDisparityPlanes (const std::vector<support_pt> &p_support,const std::vector<triangle> &tri,triangle_table &tab,
+                               const uint8_t* I_desc,bool right_image);
+  void markPlanarTriangles (const std::vector<support_pt> &p_support,const std::vector<triangle> &tri,triangle_table &tab,
+                            const uint8_t* I_desc,bool right_image);
+  template <typename T>
+  void createGrid (const std::vector<support_pt> &p_support,std::vector<T> &grid_cand,std::vector<uint32_t> &grid_offset,
+                   int32_t* grid_dims,bool right_image);
   void find_new_triangles(int64_t max_old_id, const std::vector<support_pt> &pt,
                           const std::vector<triangle> &tri, std::vector<support_pt> *new_pt, std::vector<sparse_triangle> *new_tri);
   int32_t *findDisparityLimits(const std::vector<Elas::support_pt> &pts,
@@ -236,26 +317,72 @@ private:
                                       const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d);
   inline void updatePosteriorMinimum (__m128i* I2_block_addr,const int32_t &d,
                                       const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d);
+  template <typename T,bool RIGHT,bool SUB,typename TD>
   inline void findMatch (int32_t &u,int32_t &v,float &plane_a,float &plane_b,float &plane_c,
-                         int32_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
-                         int32_t *P,int32_t &plane_radius,bool &valid,bool &right_image,float* D);
-  void computeDisparity (std::vector<support_pt> p_support,std::vector<triangle> tri,int32_t* disparity_grid,int32_t* grid_dims,
-                         uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D);
+                         const T* grid_cand,const uint32_t* grid_offset,int32_t *grid_dims,
+                         uint8_t* I1_desc,uint8_t* I2_desc,
+                         const int32_t *P,int32_t &plane_radius,TD* D,int32_t* C);
+  template <bool SUB,typename TD>
+  inline void fillPlane (int32_t u_begin,int32_t u_end,int32_t v,float plane_a,float plane_b,float plane_c,
+                         TD* D,int32_t* C);
+  template <typename T,bool RIGHT,bool SUB,typename TD>
+  void matchTriangles (const triangle_table &tab,
+                       const T* grid_cand,const uint32_t* grid_offset,int32_t* grid_dims,
+                       uint8_t* I1_desc,uint8_t* I2_desc,const int32_t *P,const int32_t *P_zero,
+                       int32_t plane_radius,TD* D,int32_t* C);
+  template <typename T,typename TD>
+  void computeDisparity (const triangle_table &tab,
+                         const T* grid_cand,const uint32_t* grid_offset,int32_t* grid_dims,
+                         uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,TD* D,int32_t* C=0);
+
+  // all of process() but the output format
+  template <typename TD>
+  void processImages (uint8_t* I1_,uint8_t* I2_,TD* D1,TD* D2,const int32_t* dims);
 
   // L/R consistency check
-  void leftRightConsistencyCheck (float* D1,float* D2);
+  template <typename TD> void leftRightConsistencyCheck (TD* D1,TD* D2);
+
+  // right disparities derived from the left matches and their costs C1:
+  // each right pixel takes the cheapest left pixel warped onto it and is
+  // invalidated if the second cheapest fails the support_threshold ratio
+  // test; left pixels losing a right pixel are rejected by the L/R check
+  template <typename TD> void rightFromLeftDisparity (const TD* D1,const int32_t* C1,TD* D2);
+  
+  // postprocessing (float or int16 disparities): speckles are labelled
+  // over the whole image, then all stages run fused over stripes of rows
+  template <typename TD> void postProcess (TD* D);
+  template <typename TD> void labelSmallSegments (TD* D);
   
-  // postprocessing
-  void removeSmallSegments (float* D);
-  void gapInterpolation (float* D);
+  // stages of postProcess() over the rows [v_begin,v_end), called in
+  // increasing row order on the workspaces postProcess() prepared. Row
+  // stages need the final input rows, column stages the rows above and
+  // below. They are called by all threads of postProcess()'s parallel
+  // region.
+  template <typename TD> void removeSmallSegments (TD* D,int32_t v_begin,int32_t v_end);
+  template <typename TD> void gapInterpolationRows (TD* D,int32_t v_begin,int32_t v_end);
+  template <typename TD> void gapInterpolationColumns (TD* D,int32_t v_begin,int32_t v_end);
 
   // optional postprocessing
-  void adaptiveMean (float* D);
-  void median (float* D);
+  void adaptiveMeanRows (float* D,int32_t v_begin,int32_t v_end);
+  void adaptiveMeanRows (int16_t* D,int32_t v_begin,int32_t v_end);
+  void adaptiveMeanColumns (float* D,int32_t v_begin,int32_t v_end);
+  void adaptiveMeanColumns (int16_t* D,int32_t v_begin,int32_t v_end);
+  template <typename TD> void medianRows (TD* D,int32_t v_begin,int32_t v_end);
+  template <typename TD> void medianColumns (TD* D,int32_t v_begin,int32_t v_end);
+  std::vector<float>&   meanCopyBuffer (const float*)   { return mean_copy_; }
+  std::vector<int16_t>& meanCopyBuffer (const int16_t*) { return mean_copy16_; }
+  std::vector<float>&   meanTmpBuffer (const float*)    { return mean_tmp_; }
+  std::vector<int16_t>& meanTmpBuffer (const int16_t*)  { return mean_tmp16_; }
+  std::vector<float>&   medianBuffer (const float*)     { return median_tmp_; }
+  std::vector<int16_t>& medianBuffer (const int16_t*)   { return median_tmp16_; }
   
   // parameter set
   parameters param;
 
+  // not copyable (owns the triangulation context)
+  Elas (const Elas&);
+  Elas& operator= (const Elas&);
+
   // support points
   std::vector<support_pt> p_support_;
   // new support points
@@ -265,10 +392,87 @@ private:
   std::vector<triangle> tri_1_;
   std::vector<triangle> tri_2_;
 
+  // corners and disparity planes of left and right triangles
+  triangle_table tab_1_;
+  triangle_table tab_2_;
+
+  // left and right disparity grids
+  disparity_grid grid_1_;
+  disparity_grid grid_2_;
+
   // existing triangles
   std::vector<sparse_triangle> tri_exist_;
   // new triangles
   std::vector<sparse_triangle> tri_left_new_;
+  // flags of new points already emitted by find_new_triangles
+  std::vector<uint8_t> new_pt_emitted_;
+
+  // Triangle's pools and buffers, kept across frames
+  triangulatecontext *tri_ctx_;
+
+  // incremental left image triangulation, kept across frames
+  Delaunay delaunay_;
+  // (support point id, vertex handle) of the triangulated points, sorted by id
+  std::vector<std::pair<uint64_t,int32_t> > delaunay_ids_;
+  // scratch buffers: sorted ids of the current points, the next
+  // delaunay_ids_, vertices to re-insert, handle -> point index and the
+  // triangle corners
+  std::vector<std::pair<uint64_t,int32_t> > delaunay_sorted_;
+  std::vector<std::pair<uint64_t,int32_t> > delaunay_next_;
+  std::vector<int32_t> delaunay_relocate_;
+  std::vector<int32_t> delaunay_index_;
+  std::vector<int32_t> delaunay_corners_;
+
+  // left image triangulation of lattice support points, rebuilt every frame:
+  // lattice coordinates, vertex handles, handle -> point index and the
+  // indices of lattice / off-lattice points
+  Delaunay lattice_;
+  std::vector<int32_t> lattice_u_,lattice_v_,lattice_handle_,lattice_index_;
+  std::vector<int32_t> lattice_pts_,lattice_off_,lattice_corners_;
+
+  // (corner key, edge) of all triangle edges and the number of planar
+  // neighbours per triangle, markPlanarTriangles()
+  std::vector<std::pair<int64_t,int32_t> > planar_edges_;
+  std::vector<int32_t> planar_count_;
+
+  // candidate bit masks of each grid cell before and after the diffusion,
+  // createGrid()
+  std::vector<uint64_t> grid_mask_,grid_diffused_;
+
+  // vertical pixel span of each column within a triangle, matchTriangles()
+  std::vector<int32_t> span_lo_,span_hi_;
+
+  // left and right row copies of each thread, leftRightConsistencyCheck()
+  std::vector<float> lr_rows_;
+
+  // best and second best cost per right pixel, rightFromLeftDisparity()
+  std::vector<int32_t> right_cost_;
+
+  // matching prior and its zero counterpart of computeDisparity()
+  // (zero padded for SIMD loads)
+  std::vector<int32_t> prior_,prior_zero_;
+
+  // scratch buffers of labelSmallSegments(): run offsets per row, run
+  // extents, union-find parents, segment sizes and first visits, invalid
+  // seeds next to similar segments, the segments to remove and the
+  // (address, disparity) of invalid seeds that keep their value
+  std::vector<int32_t> speckle_row_first_,speckle_u0_,speckle_u1_,speckle_parent_;
+  std::vector<int32_t> speckle_count_,speckle_first_;
+  std::vector<std::pair<int32_t,int32_t> > speckle_seeds_;
+  std::vector<uint8_t> speckle_remove_;
+  std::vector<std::pair<int32_t,float> > speckle_kept_;
+
+  // gap length per column of gapInterpolationColumns()
+  std::vector<int32_t> gap_count_;
+
+  // workspace of the adaptive mean: disparities with invalid ones set to
+  // -10 and the result of the horizontal pass
+  std::vector<float>   mean_copy_,mean_tmp_;
+  std::vector<int16_t> mean_copy16_,mean_tmp16_;
+
+  // result of the horizontal median pass
+  std::vector<float>   median_tmp_;
+  std::vector<int16_t> median_tmp16_;
 
   // memory aligned input images + dimensions
   uint8_t *I1,*I2;
@@ -0,0 +1,116 @@
+/*
+Copyright 2011. All rights reserved.
+Institute of Measurement and Control Systems
+Karlsruhe Institute of Technology, Germany
+
+This file is part of libelas.
+Authors: Andreas Geiger
+
+libelas is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or any later version.
+
+libelas is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+libelas; if not, write to the Free Software Foundation, Inc., 51 Franklin
+Street, Fifth Floor, Boston, MA 02110-1301, USA 
+*/
+
+// Fixed-size 3x3 / 3x1 matrices for the triangle and plane computations.
+// Unlike Matrix (matrix.h) these live on the stack, are trivially copyable
+// and use closed-form inversion, so they can be embedded in the triangle
+// structs without any heap traffic.
+
+#ifndef __MATRIX33_H__
+#define __MATRIX33_H__
+
+#include <math.h>
+
+struct Vector3 {
+
+  double val[3];
+
+  Vector3 () {}
+  Vector3 (const double a,const double b,const double c) { val[0] = a; val[1] = b; val[2] = c; }
+};
+
+struct Matrix33 {
+
+  // direct data access, val[row][col] as in Matrix
+  double val[3][3];
+
+  Matrix33 () {}
+
+  // matrix with the three vectors as columns
+  static Matrix33 fromColumns (const Vector3 &c0,const Vector3 &c1,const Vector3 &c2) {
+    Matrix33 M;
+    for (int i=0; i<3; i++) {
+      M.val[i][0] = c0.val[i];
+      M.val[i][1] = c1.val[i];
+      M.val[i][2] = c2.val[i];
+    }
+    return M;
+  }
+
+  void zero () {
+    for (int i=0; i<3; i++)
+      for (int j=0; j<3; j++)
+        val[i][j] = 0;
+  }
+
+  double det () const {
+    return val[0][0]*(val[1][1]*val[2][2]-val[1][2]*val[2][1])
+          -val[0][1]*(val[1][0]*val[2][2]-val[1][2]*val[2][0])
+          +val[0][2]*(val[1][0]*val[2][1]-val[1][1]*val[2][0]);
+  }
+
+  // closed-form inverse (adjugate / determinant), returns false and
+  // leaves Minv zeroed if the matrix is singular
+  bool inv (Matrix33 &Minv,const double eps=1e-20) const {
+    const double d = det();
+    if (fabs(d)<eps) {
+      Minv.zero();
+      return false;
+    }
+    const double s = 1.0/d;
+    Minv.val[0][0] = (val[1][1]*val[2][2]-val[1][2]*val[2][1])*s;
+    Minv.val[0][1] = (val[0][2]*val[2][1]-val[0][1]*val[2][2])*s;
+    Minv.val[0][2] = (val[0][1]*val[1][2]-val[0][2]*val[1][1])*s;
+    Minv.val[1][0] = (val[1][2]*val[2][0]-val[1][0]*val[2][2])*s;
+    Minv.val[1][1] = (val[0][0]*val[2][2]-val[0][2]*val[2][0])*s;
+    Minv.val[1][2] = (val[0][2]*val[1][0]-val[0][0]*val[1][2])*s;
+    Minv.val[2][0] = (val[1][0]*val[2][1]-val[1][1]*val[2][0])*s;
+    Minv.val[2][1] = (val[0][1]*val[2][0]-val[0][0]*val[2][1])*s;
+    Minv.val[2][2] = (val[0][0]*val[1][1]-val[0][1]*val[1][0])*s;
+    return true;
+  }
+
+  // solve M*x=b with Cramer's rule, returns false if M is singular
+  bool solve (const Vector3 &b,Vector3 &x,const double eps=1e-20) const {
+    const double d = det();
+    if (fabs(d)<eps)
+      return false;
+    const double s = 1.0/d;
+    x.val[0] = (b.val[0]*(val[1][1]*val[2][2]-val[1][2]*val[2][1])
+               -val[0][1]*(b.val[1]*val[2][2]-val[1][2]*b.val[2])
+               +val[0][2]*(b.val[1]*val[2][1]-val[1][1]*b.val[2]))*s;
+    x.val[1] = (val[0][0]*(b.val[1]*val[2][2]-val[1][2]*b.val[2])
+               -b.val[0]*(val[1][0]*val[2][2]-val[1][2]*val[2][0])
+               +val[0][2]*(val[1][0]*b.val[2]-b.val[1]*val[2][0]))*s;
+    x.val[2] = (val[0][0]*(val[1][1]*b.val[2]-b.val[1]*val[2][1])
+               -val[0][1]*(val[1][0]*b.val[2]-b.val[1]*val[2][0])
+               +b.val[0]*(val[1][0]*val[2][1]-val[1][1]*val[2][0]))*s;
+    return true;
+  }
+
+  Vector3 operator* (const Vector3 &x) const {
+    return Vector3(val[0][0]*x.val[0]+val[0][1]*x.val[1]+val[0][2]*x.val[2],
+                   val[1][0]*x.val[0]+val[1][1]*x.val[1]+val[1][2]*x.val[2],
+                   val[2][0]*x.val[0]+val[2][1]*x.val[1]+val[2][2]*x.val[2]);
+  }
+};
+
+#endif
@@ -283,3 +283,15 @@ struct triangulateio {
 void triangulate(char *,triangulateio *,triangulateio *,triangulateio *);
 void trifree(int *memptr);
 
+
+/*  Persistent triangulation context (plain Delaunay triangulation only).    */
+/*  The memory pools, the point buffer and the triangle list are kept alive  */
+/*  between runs.  Fill the buffer returned by triangulatecontextpoints()    */
+/*  with x/y pairs, then call triangulatecontextrun(); the returned triangle */
+/*  list is owned by the context and valid until the next run.               */
+
+struct triangulatecontext;
+struct triangulatecontext *triangulatecontextnew(char *triswitches);
+void triangulatecontextdelete(struct triangulatecontext *ctx);
+float *triangulatecontextpoints(struct triangulatecontext *ctx,int numberofpoints);
+int triangulatecontextrun(struct triangulatecontext *ctx,int numberofpoints,int **trianglelist);
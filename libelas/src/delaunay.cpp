@@ -0,0 +1,666 @@
+/*
+This file is part of libelas.
+
+libelas is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or any later version.
+
+libelas is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+libelas; if not, write to the Free Software Foundation, Inc., 51 Franklin
+Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include "delaunay.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// exact in-circle determinants need about 4x the coordinate bits
+#ifdef __SIZEOF_INT128__
+typedef __int128 wide_t;
+#else
+typedef long double wide_t;
+#endif
+
+// sign of the in-circle determinant: 1 if (d) lies inside the
+// circumcircle of the ccw triangle (a,b,c), 0 if on it, -1 otherwise
+static inline int32_t incircle3 (const int64_t ax,const int64_t ay,const int64_t bx,const int64_t by,
+                                 const int64_t cx,const int64_t cy,const int64_t dx,const int64_t dy) {
+  const int64_t adx = ax-dx, ady = ay-dy;
+  const int64_t bdx = bx-dx, bdy = by-dy;
+  const int64_t cdx = cx-dx, cdy = cy-dy;
+  const wide_t det = (wide_t)(adx*adx+ady*ady)*(bdx*cdy-cdx*bdy)
+                    +(wide_t)(bdx*bdx+bdy*bdy)*(cdx*ady-adx*cdy)
+                    +(wide_t)(cdx*cdx+cdy*cdy)*(adx*bdy-bdx*ady);
+  return det>0 ? 1 : (det<0 ? -1 : 0);
+}
+
+static inline bool contains (const vector<int32_t> &v,int32_t x) {
+  for (int32_t i=0; i<(int32_t)v.size(); i++)
+    if (v[i]==x)
+      return true;
+  return false;
+}
+
+void Delaunay::reset () {
+  vtx.clear();
+  tris.clear();
+  free_vtx.clear();
+  free_tris.clear();
+  moved.clear();
+
+  // frame vertices 0..3 (ccw) and two triangles covering the frame
+  newVertex(-frame_size,-frame_size);
+  newVertex( frame_size,-frame_size);
+  newVertex( frame_size, frame_size);
+  newVertex(-frame_size, frame_size);
+  int32_t t0 = newTriangle(0,1,2);
+  int32_t t1 = newTriangle(0,2,3);
+  tris[t0].n[1] = t1;
+  tris[t1].n[2] = t0;
+  last_tri = t0;
+}
+
+int64_t Delaunay::orient (int32_t a,int32_t b,int32_t x,int32_t y) const {
+  return ((int64_t)vtx[b].x-vtx[a].x)*((int64_t)y-vtx[a].y)-((int64_t)vtx[b].y-vtx[a].y)*((int64_t)x-vtx[a].x);
+}
+
+int32_t Delaunay::incircle (int32_t t,int32_t x,int32_t y) const {
+  const vertex &a = vtx[tris[t].v[0]];
+  const vertex &b = vtx[tris[t].v[1]];
+  const vertex &c = vtx[tris[t].v[2]];
+  return incircle3(a.x,a.y,b.x,b.y,c.x,c.y,x,y);
+}
+
+int32_t Delaunay::locate (int32_t x,int32_t y,int32_t hint) const {
+  int32_t t = hint>=0 && hint<(int32_t)vtx.size() && vtx[hint].tri>=0 ? vtx[hint].tri : last_tri;
+
+  // visibility walk, the rotating start edge avoids cycling
+  int32_t r = 0;
+  for (int32_t steps=0; steps<(int32_t)tris.size()+16; steps++) {
+    const tri &T = tris[t];
+    int32_t next = -1;
+    for (int32_t k=0; k<3; k++) {
+      int32_t i = (k+r)%3;
+      if (orient(T.v[(i+1)%3],T.v[(i+2)%3],x,y)<0) {
+        next = T.n[i];
+        break;
+      }
+    }
+    if (next<0) {
+      // inside (or outside the frame, which insert() rules out)
+      return t;
+    }
+    t = next;
+    r++;
+  }
+  return -1;
+}
+
+int32_t Delaunay::newVertex (int32_t x,int32_t y) {
+  int32_t v;
+  if (!free_vtx.empty()) {
+    v = free_vtx.back();
+    free_vtx.pop_back();
+  } else {
+    v = vtx.size();
+    vtx.push_back(vertex());
+    start_tri.push_back(-1);
+  }
+  vtx[v].x   = x;
+  vtx[v].y   = y;
+  vtx[v].tri = -1;
+  return v;
+}
+
+int32_t Delaunay::newTriangle (int32_t a,int32_t b,int32_t c) {
+  int32_t t;
+  if (!free_tris.empty()) {
+    t = free_tris.back();
+    free_tris.pop_back();
+  } else {
+    t = tris.size();
+    tris.push_back(tri());
+  }
+  tri &T = tris[t];
+  T.v[0] = a; T.v[1] = b; T.v[2] = c;
+  T.n[0] = T.n[1] = T.n[2] = -1;
+  vtx[a].tri = vtx[b].tri = vtx[c].tri = t;
+  return t;
+}
+
+void Delaunay::freeTriangle (int32_t t) {
+  tris[t].v[0] = -1;
+  free_tris.push_back(t);
+}
+
+// in triangle t, set the neighbor across the edge {a,b}
+void Delaunay::setNeighbor (int32_t t,int32_t a,int32_t b,int32_t nb) {
+  tri &T = tris[t];
+  for (int32_t i=0; i<3; i++) {
+    if (T.v[i]!=a && T.v[i]!=b) {
+      T.n[i] = nb;
+      return;
+    }
+  }
+}
+
+// make t and nb neighbors across the edge {a,b}
+void Delaunay::link (int32_t t,int32_t a,int32_t b,int32_t nb) {
+  setNeighbor(t,a,b,nb);
+  if (nb>=0)
+    setNeighbor(nb,a,b,t);
+}
+
+int32_t Delaunay::insert (int32_t x,int32_t y,int32_t hint) {
+
+  if (!insideFrame(x,y))
+    return -1;
+
+  // if the walk fails, re-triangulate all vertices and try again
+  int32_t t = locate(x,y,hint);
+  if (t<0) {
+    rebuild();
+    t = locate(x,y,-1);
+    if (t<0)
+      return -1;
+  }
+
+  // reject duplicates
+  for (int32_t i=0; i<3; i++) {
+    const vertex &c = vtx[tris[t].v[i]];
+    if (c.x==x && c.y==y)
+      return -1;
+  }
+
+  int32_t p = newVertex(x,y);
+  insertVertex(p,t);
+  return p;
+}
+
+void Delaunay::rebuild () {
+
+  // live vertices keep their handles and positions
+  rebuild_vtx.clear();
+  for (int32_t v=4; v<(int32_t)vtx.size(); v++) {
+    if (vtx[v].tri>=0)
+      rebuild_vtx.push_back(v);
+    vtx[v].tri = -1;
+  }
+
+  // empty frame, then insert the vertices again
+  tris.clear();
+  free_tris.clear();
+  moved.clear();
+  int32_t t0 = newTriangle(0,1,2);
+  int32_t t1 = newTriangle(0,2,3);
+  tris[t0].n[1] = t1;
+  tris[t1].n[2] = t0;
+  last_tri = t0;
+  for (int32_t k=0; k<(int32_t)rebuild_vtx.size(); k++) {
+    int32_t v = rebuild_vtx[k];
+    int32_t t = locate(vtx[v].x,vtx[v].y,-1);
+    if (t>=0)
+      insertVertex(v,t);
+    else
+      free_vtx.push_back(v);
+  }
+}
+
+void Delaunay::insertVertex (int32_t p,int32_t t) {
+
+  const int32_t x = vtx[p].x, y = vtx[p].y;
+
+  // grow the cavity of triangles whose circumcircle contains the point
+  cavity.clear();
+  cavity.push_back(t);
+  for (int32_t k=0; k<(int32_t)cavity.size(); k++) {
+    const tri &T = tris[cavity[k]];
+    for (int32_t i=0; i<3; i++) {
+      int32_t nb = T.n[i];
+      if (nb<0 || contains(cavity,nb))
+        continue;
+      if (incircle(nb,x,y)>0)
+        cavity.push_back(nb);
+    }
+  }
+
+  // collect boundary edges (a,b,outer); every edge must see the new point,
+  // otherwise the cavity is extended to keep it star-shaped
+  bool star_shaped;
+  do {
+    star_shaped = true;
+    boundary.clear();
+    for (int32_t k=0; k<(int32_t)cavity.size() && star_shaped; k++) {
+      const tri &T = tris[cavity[k]];
+      for (int32_t i=0; i<3; i++) {
+        int32_t nb = T.n[i];
+        if (nb>=0 && contains(cavity,nb))
+          continue;
+        int32_t a = T.v[(i+1)%3];
+        int32_t b = T.v[(i+2)%3];
+        if (orient(a,b,x,y)<=0 && nb>=0) {
+          cavity.push_back(nb);
+          star_shaped = false;
+          break;
+        }
+        boundary.push_back(a);
+        boundary.push_back(b);
+        boundary.push_back(nb);
+      }
+    }
+  } while (!star_shaped);
+
+  // replace the cavity by a fan around the new vertex
+  for (int32_t k=0; k<(int32_t)cavity.size(); k++)
+    freeTriangle(cavity[k]);
+  for (int32_t k=0; k<(int32_t)boundary.size(); k+=3) {
+    int32_t a = boundary[k], b = boundary[k+1];
+    int32_t T = newTriangle(a,b,p);
+    link(T,a,b,boundary[k+2]);
+    start_tri[a] = T;
+  }
+
+  // connect the fan: (a,b,p) shares (b,p) with the triangle starting at b
+  for (int32_t k=0; k<(int32_t)boundary.size(); k+=3) {
+    int32_t T  = start_tri[boundary[k]];
+    int32_t nb = start_tri[boundary[k+1]];
+    tris[T].n[0]  = nb;
+    tris[nb].n[1] = T;
+  }
+  for (int32_t k=0; k<(int32_t)boundary.size(); k+=3)
+    start_tri[boundary[k]] = -1;
+
+  last_tri = vtx[p].tri;
+}
+
+// side edges of a strip without triangles (two single-point rows) are
+// shared by the left and right side, they refer to a slot in strip_tri
+static inline int32_t sideSlot (int32_t r) { return -2-r; }
+
+int32_t Delaunay::sideTriangle (int32_t code) const {
+  return code>=0 ? code : (code<=-2 ? strip_tri[2*(-2-code)] : -1);
+}
+
+void Delaunay::linkSide (int32_t t,int32_t a,int32_t b,int32_t code) {
+  link(t,a,b,sideTriangle(code));
+  if (code<=-2 && strip_tri[2*(-2-code)]<0)
+    strip_tri[2*(-2-code)] = t;
+}
+
+bool Delaunay::buildLattice (const vector<int32_t> &x,const vector<int32_t> &y,int32_t step,
+                             vector<int32_t> &handle) {
+
+  reset();
+  const int32_t num = x.size();
+  handle.assign(num,-1);
+  if (num<3 || step<=0)
+    return false;
+
+  // lattice coordinates
+  int32_t cols = 0, rows = 0;
+  for (int32_t i=0; i<num; i++) {
+    if (x[i]<0 || y[i]<0 || x[i]%step || y[i]%step || !insideFrame(x[i],y[i]))
+      return false;
+    cols = max(cols,x[i]/step+1);
+    rows = max(rows,y[i]/step+1);
+  }
+
+  // counting sort by column, then (stable) by row
+  lattice_count.assign(cols+1,0);
+  for (int32_t i=0; i<num; i++)
+    lattice_count[x[i]/step+1]++;
+  for (int32_t c=0; c<cols; c++)
+    lattice_count[c+1] += lattice_count[c];
+  lattice_order.resize(2*num);
+  for (int32_t i=0; i<num; i++)
+    lattice_order[num+lattice_count[x[i]/step]++] = i;
+  lattice_count.assign(rows+1,0);
+  for (int32_t i=0; i<num; i++)
+    lattice_count[y[i]/step+1]++;
+  for (int32_t r=0; r<rows; r++)
+    lattice_count[r+1] += lattice_count[r];
+  for (int32_t k=0; k<num; k++) {
+    int32_t i = lattice_order[num+k];
+    lattice_order[lattice_count[y[i]/step]++] = i;
+  }
+
+  // create the vertices row by row (handles are consecutive within a row)
+  row_first.clear();
+  for (int32_t k=0; k<num; k++) {
+    int32_t i = lattice_order[k];
+    if (k>0) {
+      int32_t j = lattice_order[k-1];
+      if (x[i]==x[j] && y[i]==y[j])
+        continue;
+      if (y[i]!=y[j])
+        row_first.push_back(vtx.size());
+    } else {
+      row_first.push_back(vtx.size());
+    }
+    handle[i] = newVertex(x[i],y[i]);
+  }
+  row_first.push_back(vtx.size());
+  const int32_t num_rows = row_first.size()-1;
+  const int32_t num_vtx  = vtx.size();
+
+  // at least one point must be off the line through the first two
+  bool flat = true;
+  for (int32_t v=6; v<num_vtx && flat; v++)
+    if (orient(4,5,vtx[v].x,vtx[v].y)!=0)
+      flat = false;
+  if (flat) {
+    reset();
+    handle.assign(num,-1);
+    return false;
+  }
+
+  // the frame triangles of reset() are rebuilt around the hull below
+  tris.clear();
+  free_tris.clear();
+
+  // zip consecutive rows together: row_tri[h] is the (last) triangle on
+  // the row edge (h,h+1), strip_tri holds the first/last triangle of a strip
+  row_tri.assign(num_vtx,-1);
+  strip_tri.assign(2*max(num_rows-1,1),-1);
+  for (int32_t r=0; r+1<num_rows; r++) {
+    int32_t a = row_first[r],   a_end = row_first[r+1]-1;
+    int32_t b = row_first[r+1], b_end = row_first[r+2]-1;
+    int32_t prev = -1;
+    while (a<a_end || b<b_end) {
+      int32_t t;
+      if (b==b_end || (a<a_end && vtx[a+1].x<=vtx[b+1].x)) {
+        t = newTriangle(a,a+1,b);
+        if (row_tri[a]>=0) link(t,a,a+1,row_tri[a]);
+        else               row_tri[a] = t;
+        if (prev>=0) link(t,a,b,prev);
+        a++;
+      } else {
+        t = newTriangle(a,b+1,b);
+        row_tri[b] = t;
+        if (prev>=0) link(t,a,b,prev);
+        b++;
+      }
+      if (prev<0)
+        strip_tri[2*r] = t;
+      prev = t;
+    }
+    strip_tri[2*r+1] = prev;
+  }
+
+  // fill the concave pockets along the right and left side (Graham scan
+  // over the row ends); side_edge holds the triangle inside each stack edge
+  hull_vtx.clear();
+  hull_tri.clear();
+  for (int32_t side=0; side<2; side++) {
+    side_stack.clear();
+    side_edge.clear();
+    for (int32_t r=0; r<num_rows; r++) {
+      int32_t p = side==0 ? row_first[r+1]-1 : row_first[r];
+      int32_t e = -1;
+      if (r>0) {
+        bool single = row_first[r]-row_first[r-1]==1 && row_first[r+1]-row_first[r]==1;
+        e = single ? sideSlot(r-1) : strip_tri[2*(r-1)+1-side];
+      }
+      while (side_stack.size()>=2) {
+        int32_t s2 = side_stack[side_stack.size()-2];
+        int32_t s1 = side_stack.back();
+        int64_t o = orient(s2,p,vtx[s1].x,vtx[s1].y);
+        if (side==0 ? o<=0 : o>=0)
+          break;
+        int32_t t = side==0 ? newTriangle(s2,p,s1) : newTriangle(s2,s1,p);
+        linkSide(t,s2,s1,side_edge.back());
+        linkSide(t,s1,p,e);
+        side_stack.pop_back();
+        side_edge.pop_back();
+        e = t;
+      }
+      side_stack.push_back(p);
+      side_edge.push_back(e);
+    }
+
+    // hull in ccw order: bottom row, right side, top row, left side
+    if (side==0) {
+      for (int32_t h=row_first[0]; h+1<row_first[1]; h++) {
+        hull_vtx.push_back(h);
+        hull_tri.push_back(row_tri[h]);
+      }
+      for (int32_t k=0; k+1<(int32_t)side_stack.size(); k++) {
+        hull_vtx.push_back(side_stack[k]);
+        hull_tri.push_back(side_edge[k+1]);
+      }
+      for (int32_t h=row_first[num_rows]-1; h>row_first[num_rows-1]; h--) {
+        hull_vtx.push_back(h);
+        hull_tri.push_back(row_tri[h-1]);
+      }
+    } else {
+      for (int32_t k=side_stack.size()-1; k>0; k--) {
+        hull_vtx.push_back(side_stack[k]);
+        hull_tri.push_back(side_edge[k]);
+      }
+    }
+  }
+
+  // connect the hull to the frame: each hull edge gets the frame vertex
+  // in direction of its outer normal, the frame vertices switch in ccw
+  // order at hull vertices
+  const int32_t m = hull_vtx.size();
+  int32_t first = -1, last = -1, c_first = -1, c_last = -1;
+  for (int32_t i=0; i<m; i++) {
+    int32_t a = hull_vtx[i], b = hull_vtx[(i+1)%m];
+    int64_t nx = vtx[b].y-vtx[a].y, ny = vtx[a].x-vtx[b].x;
+    int32_t c = ny>0 && nx>=0 ? 2 : (nx<0 && ny>=0 ? 3 : (ny<0 && nx<=0 ? 0 : 1));
+    for (; last>=0 && c_last!=c; c_last=(c_last+1)%4) {
+      int32_t t = newTriangle(a,c_last,(c_last+1)%4);
+      link(t,a,c_last,last);
+      last = t;
+    }
+    int32_t t = newTriangle(b,a,c);
+    linkSide(t,a,b,hull_tri[i]);
+    if (last>=0) link(t,a,c,last);
+    else         first = t, c_first = c;
+    last = t;
+    c_last = c;
+  }
+  int32_t a = hull_vtx[0];
+  for (; c_last!=c_first; c_last=(c_last+1)%4) {
+    int32_t t = newTriangle(a,c_last,(c_last+1)%4);
+    link(t,a,c_last,last);
+    last = t;
+  }
+  link(first,a,c_first,last);
+  last_tri = first;
+
+  // restore the Delaunay property
+  flip_stack.clear();
+  for (int32_t t=0; t<(int32_t)tris.size(); t++)
+    for (int32_t i=0; i<3; i++)
+      if (tris[t].n[i]>t)
+        legalizeEdge(t,i);
+  flipQueued();
+  return true;
+}
+
+void Delaunay::remove (int32_t p) {
+
+  if (!isVertex(p))
+    return;
+
+  // walk the star of p in ccw order: ring vertices and outer neighbors
+  ring.clear();
+  ring_nb.clear();
+  cavity.clear();
+  int32_t t0 = vtx[p].tri, t = t0;
+  do {
+    const tri &T = tris[t];
+    int32_t j = T.v[0]==p ? 0 : (T.v[1]==p ? 1 : 2);
+    ring.push_back(T.v[(j+1)%3]);
+    ring_nb.push_back(T.n[j]);
+    cavity.push_back(t);
+    t = T.n[(j+1)%3];
+  } while (t!=t0 && t>=0 && cavity.size()<=tris.size());
+
+  for (int32_t k=0; k<(int32_t)cavity.size(); k++)
+    freeTriangle(cavity[k]);
+  vtx[p].tri = -1;
+  free_vtx.push_back(p);
+
+  // re-triangulate the star polygon by cutting Delaunay ears
+  while (ring.size()>3) {
+    const int32_t m = ring.size();
+    int32_t ear = -1, convex = -1;
+    for (int32_t i=0; i<m && ear<0; i++) {
+      const vertex &a = vtx[ring[i]];
+      const vertex &b = vtx[ring[(i+1)%m]];
+      const vertex &c = vtx[ring[(i+2)%m]];
+      if (orient(ring[i],ring[(i+1)%m],c.x,c.y)<=0)
+        continue;
+      if (convex<0)
+        convex = i;
+      bool empty = true;
+      for (int32_t k=3; k<m && empty; k++) {
+        const vertex &d = vtx[ring[(i+k)%m]];
+        if (incircle3(a.x,a.y,b.x,b.y,c.x,c.y,d.x,d.y)>0)
+          empty = false;
+      }
+      if (empty)
+        ear = i;
+    }
+    if (ear<0)
+      ear = convex>=0 ? convex : 0;
+
+    int32_t i1 = (ear+1)%m, i2 = (ear+2)%m;
+    int32_t a = ring[ear], b = ring[i1], c = ring[i2];
+    int32_t T = newTriangle(a,b,c);
+    link(T,a,b,ring_nb[ear]);
+    link(T,b,c,ring_nb[i1]);
+
+    // the new edge (a,c) replaces (a,b),(b,c) on the polygon
+    ring_nb[ear] = T;
+    ring.erase(ring.begin()+i1);
+    ring_nb.erase(ring_nb.begin()+i1);
+  }
+  int32_t T = newTriangle(ring[0],ring[1],ring[2]);
+  link(T,ring[0],ring[1],ring_nb[0]);
+  link(T,ring[1],ring[2],ring_nb[1]);
+  link(T,ring[2],ring[0],ring_nb[2]);
+  last_tri = T;
+}
+
+bool Delaunay::move (int32_t p,int32_t x,int32_t y) {
+
+  if (!isVertex(p))
+    return false;
+  if (vtx[p].x==x && vtx[p].y==y)
+    return true;
+
+  // all triangles around p must keep their orientation
+  int32_t t0 = vtx[p].tri, t = t0, count = 0;
+  do {
+    const tri &T = tris[t];
+    int32_t j = T.v[0]==p ? 0 : (T.v[1]==p ? 1 : 2);
+    if (orient(T.v[(j+1)%3],T.v[(j+2)%3],x,y)<=0)
+      return false;
+    t = T.n[(j+1)%3];
+  } while (t!=t0 && t>=0 && ++count<=(int32_t)tris.size());
+
+  vtx[p].x = x;
+  vtx[p].y = y;
+  moved.push_back(p);
+  return true;
+}
+
+void Delaunay::flip (int32_t t,int32_t i) {
+
+  // t = (a,b,c), nb = (d,c,b) share the edge (b,c)
+  tri &T = tris[t];
+  int32_t nb = T.n[i];
+  tri &N = tris[nb];
+  int32_t j = N.v[0]!=T.v[(i+1)%3] && N.v[0]!=T.v[(i+2)%3] ? 0 :
+             (N.v[1]!=T.v[(i+1)%3] && N.v[1]!=T.v[(i+2)%3] ? 1 : 2);
+  int32_t a = T.v[i], b = T.v[(i+1)%3], c = T.v[(i+2)%3], d = N.v[j];
+  int32_t t_ab = T.n[(i+2)%3], t_ca = T.n[(i+1)%3];
+  int32_t n_bd = N.n[(j+1)%3], n_dc = N.n[(j+2)%3];
+
+  // flipped: t = (a,b,d), nb = (a,d,c)
+  T.v[0] = a; T.v[1] = b; T.v[2] = d;
+  T.n[0] = n_bd; T.n[1] = nb; T.n[2] = t_ab;
+  N.v[0] = a; N.v[1] = d; N.v[2] = c;
+  N.n[0] = n_dc; N.n[1] = t_ca; N.n[2] = t;
+  if (n_bd>=0) setNeighbor(n_bd,b,d,t);
+  if (t_ca>=0) setNeighbor(t_ca,c,a,nb);
+  vtx[a].tri = vtx[b].tri = vtx[d].tri = t;
+  vtx[c].tri = nb;
+}
+
+void Delaunay::legalizeEdge (int32_t t,int32_t i) {
+  flip_stack.push_back(t);
+  flip_stack.push_back(i);
+}
+
+void Delaunay::legalize () {
+
+  // queue all edges of triangles around moved vertices
+  flip_stack.clear();
+  for (int32_t k=0; k<(int32_t)moved.size(); k++) {
+    int32_t p = moved[k];
+    if (!isVertex(p))
+      continue;
+    int32_t t0 = vtx[p].tri, t = t0, count = 0;
+    do {
+      const tri &T = tris[t];
+      int32_t j = T.v[0]==p ? 0 : (T.v[1]==p ? 1 : 2);
+      legalizeEdge(t,0);
+      legalizeEdge(t,1);
+      legalizeEdge(t,2);
+      t = T.n[(j+1)%3];
+    } while (t!=t0 && t>=0 && ++count<=(int32_t)tris.size());
+  }
+  moved.clear();
+  flipQueued();
+}
+
+void Delaunay::flipQueued () {
+
+  // Lawson flips
+  while (!flip_stack.empty()) {
+    int32_t i = flip_stack.back(); flip_stack.pop_back();
+    int32_t t = flip_stack.back(); flip_stack.pop_back();
+    const tri &T = tris[t];
+    int32_t nb = T.n[i];
+    if (T.v[0]<0 || nb<0)
+      continue;
+    const tri &N = tris[nb];
+    int32_t b = T.v[(i+1)%3], c = T.v[(i+2)%3];
+    int32_t d = N.v[0]!=b && N.v[0]!=c ? N.v[0] : (N.v[1]!=b && N.v[1]!=c ? N.v[1] : N.v[2]);
+    if (incircle(t,vtx[d].x,vtx[d].y)<=0)
+      continue;
+
+    // only flip convex quadrilaterals
+    int32_t a = T.v[i];
+    if (orient(a,b,vtx[d].x,vtx[d].y)<=0 || orient(c,a,vtx[d].x,vtx[d].y)<=0)
+      continue;
+    flip(t,i);
+    legalizeEdge(t,0);
+    legalizeEdge(t,2);
+    legalizeEdge(nb,0);
+    legalizeEdge(nb,1);
+  }
+}
+
+void Delaunay::getTriangles (vector<int32_t> &corners) const {
+  corners.clear();
+  for (int32_t t=0; t<(int32_t)tris.size(); t++) {
+    const tri &T = tris[t];
+    if (T.v[0]>=4 && T.v[1]>=4 && T.v[2]>=4) {
+      corners.push_back(T.v[0]);
+      corners.push_back(T.v[1]);
+      corners.push_back(T.v[2]);
+    }
+  }
+}
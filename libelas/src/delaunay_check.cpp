@@ -0,0 +1,223 @@
+/*
+This file is part of libelas.
+
+libelas is free software; you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation; either version 3 of the License, or any later version.
+
+libelas is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+libelas; if not, write to the Free Software Foundation, Inc., 51 Franklin
+Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+// Standalone check of the incremental Delaunay triangulation: random and
+// lattice point sets are triangulated, updated (removal, motion, insertion)
+// and rebuilt, lattice points are also triangulated by buildLattice().
+// After every step all triangles must be ccw with an empty circumcircle,
+// and the triangle count is compared against Triangle.
+// Returns 0 if all checks pass.
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "delaunay.h"
+#include "triangle.h"
+
+using namespace std;
+
+struct point {
+  int32_t x,y;
+};
+
+// number of triangles Triangle finds for the points
+static int32_t triangleCount (const vector<point> &pts) {
+  struct triangulateio in, out;
+  memset(&in,0,sizeof(in));
+  memset(&out,0,sizeof(out));
+  in.numberofpoints = pts.size();
+  in.pointlist = (float*)malloc(in.numberofpoints*2*sizeof(float));
+  for (int32_t i=0; i<(int32_t)pts.size(); i++) {
+    in.pointlist[2*i+0] = pts[i].x;
+    in.pointlist[2*i+1] = pts[i].y;
+  }
+  char parameters[] = "zQB";
+  triangulate(parameters,&in,&out,NULL);
+  int32_t num = out.numberoftriangles;
+  free(in.pointlist);
+  free(out.pointlist);
+  free(out.trianglelist);
+  return num;
+}
+
+// checks all triangles of the triangulation against the live points
+// (handle[i] is the vertex of pts[i]), prints a line and returns the
+// number of failures
+static int32_t check (const char* name,const Delaunay &delaunay,const vector<point> &pts,
+                      const vector<int32_t> &handle) {
+
+  // coordinates of all live vertex handles
+  vector<int32_t> vx(delaunay.numVertexHandles()),vy(delaunay.numVertexHandles());
+  vector<point> live;
+  for (int32_t i=0; i<(int32_t)pts.size(); i++) {
+    if (handle[i]<0)
+      continue;
+    vx[handle[i]] = pts[i].x;
+    vy[handle[i]] = pts[i].y;
+    live.push_back(pts[i]);
+  }
+
+  vector<int32_t> corners;
+  delaunay.getTriangles(corners);
+  int32_t num_tri = corners.size()/3, num_cw = 0, num_nonempty = 0;
+  for (int32_t k=0; k<(int32_t)corners.size(); k+=3) {
+    const int64_t ax = vx[corners[k]],   ay = vy[corners[k]];
+    const int64_t bx = vx[corners[k+1]], by = vy[corners[k+1]];
+    const int64_t cx = vx[corners[k+2]], cy = vy[corners[k+2]];
+    if ((bx-ax)*(cy-ay)-(by-ay)*(cx-ax)<=0)
+      num_cw++;
+
+    // exact in-circle test (coordinates are small enough for int64)
+    for (int32_t i=0; i<(int32_t)live.size(); i++) {
+      const int64_t adx = ax-live[i].x, ady = ay-live[i].y;
+      const int64_t bdx = bx-live[i].x, bdy = by-live[i].y;
+      const int64_t cdx = cx-live[i].x, cdy = cy-live[i].y;
+      const int64_t det = (adx*adx+ady*ady)*(bdx*cdy-cdx*bdy)
+                         +(bdx*bdx+bdy*bdy)*(cdx*ady-adx*cdy)
+                         +(cdx*cdx+cdy*cdy)*(adx*bdy-bdx*ady);
+      if (det>0) {
+        num_nonempty++;
+        break;
+      }
+    }
+  }
+
+  // the frame only drops slivers along the hull, never adds triangles
+  int32_t num_ref = triangleCount(live);
+  bool ok = num_cw==0 && num_nonempty==0 && num_tri<=num_ref;
+  cout << (ok ? "ok    " : "FAILED") << " " << name << ": " << live.size() << " points, "
+       << num_tri << " triangles (Triangle: " << num_ref << "), "
+       << num_cw << " not ccw, " << num_nonempty << " with non-empty circumcircle" << endl;
+  return ok ? 0 : 1;
+}
+
+// triangulates pts incrementally, then removes, moves and adds points
+// and finally rebuilds the triangulation, checking after every step
+static int32_t run (const char* name,vector<point> pts,int32_t width,int32_t height) {
+
+  int32_t failures = 0;
+  string prefix(name);
+  Delaunay delaunay;
+  vector<int32_t> handle(pts.size());
+  for (int32_t i=0; i<(int32_t)pts.size(); i++)
+    handle[i] = delaunay.insert(pts[i].x,pts[i].y);
+  failures += check((prefix+", insert").c_str(),delaunay,pts,handle);
+
+  // remove every 10th point
+  for (int32_t i=0; i<(int32_t)pts.size(); i+=10) {
+    delaunay.remove(handle[i]);
+    handle[i] = -1;
+  }
+  failures += check((prefix+", remove").c_str(),delaunay,pts,handle);
+
+  // move points by up to 2 pixels, points which would invert a triangle
+  // are re-inserted after the flips (as Elas does)
+  vector<int32_t> relocate;
+  for (int32_t i=0; i<(int32_t)pts.size(); i++) {
+    if (handle[i]<0 || rand()%4)
+      continue;
+    point p = pts[i];
+    p.x = min(max(p.x+rand()%5-2,0),width-1);
+    p.y = min(max(p.y+rand()%5-2,0),height-1);
+    if (delaunay.move(handle[i],p.x,p.y)) {
+      pts[i] = p;
+    } else {
+      delaunay.remove(handle[i]);
+      pts[i] = p;
+      relocate.push_back(i);
+    }
+  }
+  delaunay.legalize();
+  for (int32_t k=0; k<(int32_t)relocate.size(); k++)
+    handle[relocate[k]] = delaunay.insert(pts[relocate[k]].x,pts[relocate[k]].y);
+  failures += check((prefix+", move").c_str(),delaunay,pts,handle);
+
+  // add new points
+  for (int32_t k=0; k<(int32_t)pts.size()/10; k++) {
+    point p = {rand()%width,rand()%height};
+    pts.push_back(p);
+    handle.push_back(delaunay.insert(p.x,p.y));
+  }
+  failures += check((prefix+", add").c_str(),delaunay,pts,handle);
+
+  // rebuild from scratch, the handles stay valid
+  delaunay.rebuild();
+  failures += check((prefix+", rebuild").c_str(),delaunay,pts,handle);
+  return failures;
+}
+
+// triangulates the lattice points of pts (multiples of step) in linear
+// time, then inserts the others
+static int32_t runLattice (const char* name,const vector<point> &pts,int32_t step) {
+
+  vector<int32_t> x,y,index,handle(pts.size(),-1),lattice_handle;
+  for (int32_t i=0; i<(int32_t)pts.size(); i++) {
+    if (pts[i].x%step==0 && pts[i].y%step==0) {
+      x.push_back(pts[i].x);
+      y.push_back(pts[i].y);
+      index.push_back(i);
+    }
+  }
+  Delaunay delaunay;
+  if (!delaunay.buildLattice(x,y,step,lattice_handle)) {
+    cout << "FAILED " << name << ": buildLattice" << endl;
+    return 1;
+  }
+  for (int32_t k=0; k<(int32_t)index.size(); k++)
+    handle[index[k]] = lattice_handle[k];
+  for (int32_t i=0; i<(int32_t)pts.size(); i++)
+    if (pts[i].x%step!=0 || pts[i].y%step!=0)
+      handle[i] = delaunay.insert(pts[i].x,pts[i].y);
+  return check(name,delaunay,pts,handle);
+}
+
+int main (int argc,char** argv) {
+
+  const int32_t width = 640, height = 480;
+  int32_t failures = 0;
+  srand(argc>1 ? atoi(argv[1]) : 1);
+
+  // random points (with duplicates)
+  vector<point> pts;
+  for (int32_t i=0; i<2000; i++) {
+    point p = {rand()%width,rand()%height};
+    pts.push_back(p);
+  }
+  failures += run("random",pts,width,height);
+
+  // lattice points (cocircular everywhere) with gaps and a few off-lattice
+  // points, as produced by the support point matching
+  pts.clear();
+  for (int32_t y=0; y<height; y+=5) {
+    for (int32_t x=0; x<width; x+=5) {
+      if (rand()%3==0)
+        continue;
+      point p = {x,y};
+      pts.push_back(p);
+    }
+  }
+  for (int32_t i=0; i<20; i++) {
+    point p = {rand()%width,rand()%height};
+    pts.push_back(p);
+  }
+  failures += run("lattice",pts,width,height);
+  failures += runLattice("lattice, buildLattice",pts,5);
+
+  cout << (failures ? "FAILED" : "passed") << endl;
+  return failures ? 1 : 0;
+}
@@ -25,12 +25,13 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 
 using namespace std;
 
-Descriptor::Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution) {
-  I_desc        = (uint8_t*)_mm_malloc(16*width*height*sizeof(uint8_t),16);
+Descriptor::Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,int32_t step) {
+  int32_t rows  = (height+step-1)/step;
+  I_desc        = (uint8_t*)_mm_malloc(16*width*rows*sizeof(uint8_t),16);
   uint8_t* I_du = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
   uint8_t* I_dv = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
   filter::sobel3x3(I,I_du,I_dv,bpl,height);
-  createDescriptor(I_du,I_dv,width,height,bpl,half_resolution);
+  createDescriptor(I_du,I_dv,width,height,bpl,step);
   _mm_free(I_du);
   _mm_free(I_dv);
 }
@@ -39,75 +40,38 @@ Descriptor::~Descriptor() {
   _mm_free(I_desc);
 }
 
-void Descriptor::createDescriptor (uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,bool half_resolution) {
+void Descriptor::createDescriptor (uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,int32_t step) {
 
   uint8_t *I_desc_curr;  
   uint32_t addr_v0,addr_v1,addr_v2,addr_v3,addr_v4;
   
-  // do not compute every second line
-  if (half_resolution) {
-  
-    // create filter strip
-    for (int32_t v=4; v<height-3; v+=2) {
-
-      addr_v2 = v*bpl;
-      addr_v0 = addr_v2-2*bpl;
-      addr_v1 = addr_v2-1*bpl;
-      addr_v3 = addr_v2+1*bpl;
-      addr_v4 = addr_v2+2*bpl;
-
-      for (int32_t u=3; u<width-3; u++) {
-        I_desc_curr = I_desc+(v*width+u)*16;
-        *(I_desc_curr++) = *(I_du+addr_v0+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_du+addr_v3+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v4+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_dv+addr_v3+u+0);
-      }
-    }
-    
-  // compute full descriptor images
-  } else {
-    
-    // create filter strip
-    for (int32_t v=3; v<height-3; v++) {
+  // create filter strip (only every step-th line)
+  for (int32_t v=(3+step-1)/step*step; v<height-3; v+=step) {
 
-      addr_v2 = v*bpl;
-      addr_v0 = addr_v2-2*bpl;
-      addr_v1 = addr_v2-1*bpl;
-      addr_v3 = addr_v2+1*bpl;
-      addr_v4 = addr_v2+2*bpl;
+    addr_v2 = v*bpl;
+    addr_v0 = addr_v2-2*bpl;
+    addr_v1 = addr_v2-1*bpl;
+    addr_v3 = addr_v2+1*bpl;
+    addr_v4 = addr_v2+2*bpl;
 
-      for (int32_t u=3; u<width-3; u++) {
-        I_desc_curr = I_desc+(v*width+u)*16;
-        *(I_desc_curr++) = *(I_du+addr_v0+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_du+addr_v3+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v4+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_dv+addr_v3+u+0);
-      }
+    for (int32_t u=3; u<width-3; u++) {
+      I_desc_curr = I_desc+((v/step)*width+u)*16;
+      *(I_desc_curr++) = *(I_du+addr_v0+u+0);
+      *(I_desc_curr++) = *(I_du+addr_v1+u-2);
+      *(I_desc_curr++) = *(I_du+addr_v1+u+0);
+      *(I_desc_curr++) = *(I_du+addr_v1+u+2);
+      *(I_desc_curr++) = *(I_du+addr_v2+u-1);
+      *(I_desc_curr++) = *(I_du+addr_v2+u+0);
+      *(I_desc_curr++) = *(I_du+addr_v2+u+0);
+      *(I_desc_curr++) = *(I_du+addr_v2+u+1);
+      *(I_desc_curr++) = *(I_du+addr_v3+u-2);
+      *(I_desc_curr++) = *(I_du+addr_v3+u+0);
+      *(I_desc_curr++) = *(I_du+addr_v3+u+2);
+      *(I_desc_curr++) = *(I_du+addr_v4+u+0);
+      *(I_desc_curr++) = *(I_dv+addr_v1+u+0);
+      *(I_desc_curr++) = *(I_dv+addr_v2+u-1);
+      *(I_desc_curr++) = *(I_dv+addr_v2+u+1);
+      *(I_desc_curr++) = *(I_dv+addr_v3+u+0);
     }
   }
   
@@ -22,32 +22,56 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include "elas.h"
 
 #include <math.h>
-#include <set>
 #include <map>
+#include <algorithm>
 #include <unistd.h>
 #include "descriptor.h"
 #include "triangle.h"
-#include "matrix.h"
+
+#ifdef __AVX2__
+  #include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
 
 using namespace std;
 
-Elas::Elas(parameters param) : param(param),  point_id_(1LL) {
+Elas::Elas(parameters param) : param(param), tri_ctx_(NULL), point_id_(1LL) {
+}
+
+Elas::~Elas() {
+  triangulatecontextdelete(tri_ctx_);
 }
 
 static void update_triangles(const std::vector<Elas::support_pt> &pts,
                              std::vector<Elas::sparse_triangle> *st) {
   for (int i = 0; i < st->size(); i++) {
     Elas::sparse_triangle &t =  (*st)[i];
-    Matrix A(3,3);
-    A.val[0][0] = pts[t.cidx[0]].u; A.val[1][0] = pts[t.cidx[0]].v; A.val[2][0] = 1;
-    A.val[0][1] = pts[t.cidx[1]].u; A.val[1][1] = pts[t.cidx[1]].v; A.val[2][1] = 1;
-    A.val[0][2] = pts[t.cidx[2]].u; A.val[1][2] = pts[t.cidx[2]].v; A.val[2][2] = 1;
-    t.Ainv = Matrix::inv(A);
+    const Elas::support_pt &p0 = pts[t.cidx[0]];
+    const Elas::support_pt &p1 = pts[t.cidx[1]];
+    const Elas::support_pt &p2 = pts[t.cidx[2]];
+    Matrix33 A = Matrix33::fromColumns(Vector3(p0.u,p0.v,1),Vector3(p1.u,p1.v,1),Vector3(p2.u,p2.v,1));
+    A.inv(t.Ainv);
   }
 }
 
 
+const int16_t Elas::disp16_invalid;
+
 void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t* dims){
+  processImages(I1_,I2_,D1,D2,dims);
+}
+
+void Elas::process (uint8_t* I1_,uint8_t* I2_,int16_t* D1,int16_t* D2,const int32_t* dims){
+  processImages(I1_,I2_,D1,D2,dims);
+}
+
+template <typename TD>
+void Elas::processImages (uint8_t* I1_,uint8_t* I2_,TD* D1,TD* D2,const int32_t* dims){
   // get width, height and bytes per line
   width  = dims[0];
   height = dims[1];
@@ -67,18 +91,16 @@ void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t*
     }
   }
   
-  // allocate memory for disparity grid
+  // disparity grid dimensions, candidates are stored relative to disp_min
   int32_t grid_width   = (int32_t)ceil((float)width/(float)param.grid_size);
   int32_t grid_height  = (int32_t)ceil((float)height/(float)param.grid_size);
-  int32_t grid_dims[3] = {param.disp_max+2,grid_width,grid_height};
-  int32_t* disparity_grid_1 = (int32_t*)calloc((param.disp_max+2)*grid_height*grid_width,sizeof(int32_t));
-  int32_t* disparity_grid_2 = (int32_t*)calloc((param.disp_max+2)*grid_height*grid_width,sizeof(int32_t));
+  int32_t grid_dims[3] = {param.disp_max-max(param.disp_min,0)+1,grid_width,grid_height};
 
 #ifdef PROFILE
   timer.start("Descriptor");
 #endif
-  Descriptor desc1(I1,width,height,bpl,param.subsampling);
-  Descriptor desc2(I2,width,height,bpl,param.subsampling);
+  Descriptor desc1(I1,width,height,bpl,subsamplingStep());
+  Descriptor desc2(I2,width,height,bpl,subsamplingStep());
 
   unsigned int npts = p_support_.size();
   //int16_t *exist_pt = filterSupportPoints();
@@ -126,8 +148,10 @@ void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t*
 #ifdef PROFILE
   timer.start("Delaunay Triangulation");
 #endif
-  tri_1_ = computeDelaunayTriangulation(p_support_,0);
-  //tri_2_ = computeDelaunayTriangulation(p_support_,1);
+  if (param.incremental_triangulation)
+    computeIncrementalTriangulation(p_support_,tri_1_);
+  else
+    computeDelaunayTriangulation(p_support_,0,tri_1_);
 
 #ifdef PROFILE
   timer.start("Find new triangles");
@@ -136,62 +160,69 @@ void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t*
   p_support_new_.clear();
   find_new_triangles(max_old_point_id, p_support_, tri_1_, &p_support_new_, &tri_left_new_);
 
-//#define DO_EVERYTHING
+  // dense matching, enabled by the DO_EVERYTHING build option
 #ifdef DO_EVERYTHING
+  // derive the right disparities from the left matching costs
+  bool lr_from_left = param.lr_from_left && param.postprocess_only_left;
+  if (!lr_from_left) {
+#ifdef PROFILE
+    timer.start("Delaunay Triangulation (right)");
+#endif
+    computeDelaunayTriangulation(p_support_,1,tri_2_);
+  }
+
 #ifdef PROFILE
   timer.start("Disparity Planes");
 #endif
-  computeDisparityPlanes(p_support_,tri_1_,0);
-  computeDisparityPlanes(p_support_,tri_2_,1);
+  computeDisparityPlanes(p_support_,tri_1_,tab_1_,desc1.I_desc,0);
+  if (!lr_from_left)
+    computeDisparityPlanes(p_support_,tri_2_,tab_2_,desc2.I_desc,1);
 
 #ifdef PROFILE
   timer.start("Grid");
 #endif
-  createGrid(p_support_,disparity_grid_1,grid_dims,0);
-  createGrid(p_support_,disparity_grid_2,grid_dims,1);
+  // candidates are stored as uint8 if they fit
+  bool grid_8bit = grid_dims[0]<=256;
+  if (grid_8bit) {
+    createGrid(p_support_,grid_1_.cand8,grid_1_.offset,grid_dims,0);
+    if (!lr_from_left)
+      createGrid(p_support_,grid_2_.cand8,grid_2_.offset,grid_dims,1);
+  } else {
+    createGrid(p_support_,grid_1_.cand16,grid_1_.offset,grid_dims,0);
+    if (!lr_from_left)
+      createGrid(p_support_,grid_2_.cand16,grid_2_.offset,grid_dims,1);
+  }
 
 #ifdef PROFILE
   timer.start("Matching");
 #endif
-  computeDisparity(p_support_,tri_1_,disparity_grid_1,grid_dims,desc1.I_desc,desc2.I_desc,0,D1);
-  computeDisparity(p_support_,tri_2_,disparity_grid_2,grid_dims,desc1.I_desc,desc2.I_desc,1,D2);
+  int32_t* C1 = 0;
+  if (lr_from_left) {
+    int32_t D_size = (width/subsamplingStep())*(height/subsamplingStep());
+    C1 = (int32_t*)malloc(D_size*sizeof(int32_t));
+  }
+  if (grid_8bit) {
+    computeDisparity(tab_1_,grid_1_.cand8.data(),grid_1_.offset.data(),grid_dims,desc1.I_desc,desc2.I_desc,0,D1,C1);
+    if (!lr_from_left)
+      computeDisparity(tab_2_,grid_2_.cand8.data(),grid_2_.offset.data(),grid_dims,desc1.I_desc,desc2.I_desc,1,D2);
+  } else {
+    computeDisparity(tab_1_,grid_1_.cand16.data(),grid_1_.offset.data(),grid_dims,desc1.I_desc,desc2.I_desc,0,D1,C1);
+    if (!lr_from_left)
+      computeDisparity(tab_2_,grid_2_.cand16.data(),grid_2_.offset.data(),grid_dims,desc1.I_desc,desc2.I_desc,1,D2);
+  }
+  if (lr_from_left) {
+    rightFromLeftDisparity(D1,C1,D2);
+    free(C1);
+  }
 
 #ifdef PROFILE
   timer.start("L/R Consistency Check");
 #endif
   leftRightConsistencyCheck(D1,D2);
 
-#ifdef PROFILE
-  timer.start("Remove Small Segments");
-#endif
-  removeSmallSegments(D1);
-  if (!param.postprocess_only_left)
-    removeSmallSegments(D2);
-
-#ifdef PROFILE
-  timer.start("Gap Interpolation");
-#endif
-  gapInterpolation(D1);
+  postProcess(D1);
   if (!param.postprocess_only_left)
-    gapInterpolation(D2);
-
-  if (param.filter_adaptive_mean) {
-#ifdef PROFILE
-    timer.start("Adaptive Mean");
-#endif
-    adaptiveMean(D1);
-    if (!param.postprocess_only_left)
-      adaptiveMean(D2);
-  }
-
-  if (param.filter_median) {
-#ifdef PROFILE
-    timer.start("Median");
-#endif
-    median(D1);
-    if (!param.postprocess_only_left)
-      median(D2);
-  }
+    postProcess(D2);
 
 #endif
 
@@ -201,8 +232,6 @@ void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t*
 #endif
 
   // release memory
-  free(disparity_grid_1);
-  free(disparity_grid_2);
   _mm_free(I1);
   _mm_free(I2);
 }
@@ -343,14 +372,16 @@ void Elas::addCornerSupportPoints(vector<support_pt> &p_support) {
 
 inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v,uint8_t* I1_desc,uint8_t* I2_desc,const bool &right_image) {
   
+  // descriptors only hold every step-th row, v is a multiple of it
+  const int32_t step        = subsamplingStep();
   const int32_t u_step      = 2;
-  const int32_t v_step      = 2;
+  const int32_t v_step      = max(step,2);
   const int32_t window_size = 3;
   
-  int32_t desc_offset_1 = -16*u_step-16*width*v_step;
-  int32_t desc_offset_2 = +16*u_step-16*width*v_step;
-  int32_t desc_offset_3 = -16*u_step+16*width*v_step;
-  int32_t desc_offset_4 = +16*u_step+16*width*v_step;
+  int32_t desc_offset_1 = -16*u_step-16*width*(v_step/step);
+  int32_t desc_offset_2 = +16*u_step-16*width*(v_step/step);
+  int32_t desc_offset_3 = -16*u_step+16*width*(v_step/step);
+  int32_t desc_offset_4 = +16*u_step+16*width*(v_step/step);
   
   __m128i xmm1,xmm2,xmm3,xmm4,xmm5,xmm6;
 
@@ -358,7 +389,7 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
   if (u>=window_size+u_step && u<=width-window_size-1-u_step && v>=window_size+v_step && v<=height-window_size-1-v_step) {
     
     // compute desc and start addresses
-    int32_t  line_offset = 16*width*v;
+    int32_t  line_offset = 16*width*(v/step);
     uint8_t *I1_line_addr,*I2_line_addr;
     if (!right_image) {
       I1_line_addr = I1_desc+line_offset;
@@ -450,36 +481,42 @@ void Elas::find_new_triangles(const int64_t max_old_point_id,
                               const std::vector<triangle> &tri,
                               std::vector<support_pt> *new_pt,
                               std::vector<sparse_triangle> *new_tri) {
+  // ids of new points start at max_old_point_id, so a flat array
+  // indexed by (id - max_old_point_id) tracks which were emitted
+  int64_t max_id = max_old_point_id - 1;
+  for (int i = 0; i < pt.size(); i++) {
+    if ((int64_t)pt[i].id > max_id) max_id = pt[i].id;
+  }
+  new_pt_emitted_.assign(max_id - max_old_point_id + 1, 0);
+  new_pt->reserve(new_pt->size() + new_pt_emitted_.size());
+  new_tri->reserve(new_tri->size() + tri.size());
+
   // find triangles that have at least one new support point
-  std::set<int64_t> newptset;
   for (int i = 0; i < tri.size(); i++) {
     const triangle &t = tri[i];
     const int    pidx[3] = {t.c1, t.c2, t.c3};
     int64_t pid[3];
     bool isNewTriangle(false);
     for (int v = 0; v < 3; v++) {
-      int idx = pidx[v];
-      const support_pt &p = pt[idx];
+      const support_pt &p = pt[pidx[v]];
       pid[v] = p.id;
-      if (p.id >= max_old_point_id) {
+      if ((int64_t)p.id >= max_old_point_id) {
         isNewTriangle = true;
-        if (newptset.count(p.id) == 0) {
-          newptset.insert(p.id);
+        uint8_t &emitted = new_pt_emitted_[p.id - max_old_point_id];
+        if (!emitted) {
+          emitted = 1;
           new_pt->push_back(p);
         }
       }
     }
     if (isNewTriangle) {
-      sparse_triangle st(pidx, pid);
-      new_tri->push_back(st);
+      new_tri->push_back(sparse_triangle(pidx, pid));
     }
   }
 }
 
 void Elas::print_exist_grid(const int32_t *grid) {
-  int32_t D_candidate_stepsize = param.candidate_stepsize;
-  if (param.subsampling)
-    D_candidate_stepsize += D_candidate_stepsize%2; // huh?
+  int32_t D_candidate_stepsize = candidateStepsize();
   // create matrix for saving disparity candidates
   int32_t D_can_width  = (width + D_candidate_stepsize - 1) / D_candidate_stepsize;
   int32_t D_can_height = (height + D_candidate_stepsize - 1) / D_candidate_stepsize;
@@ -501,37 +538,12 @@ void Elas::print_exist_grid(const int32_t *grid) {
   }
 }
 
-static float get_depth(const std::vector<Elas::support_pt> &pts,
-                       const Elas::sparse_triangle &t, int u, int v) {
-  Matrix uv1(3,1);
-  uv1.val[0][0] = u;  uv1.val[0][1] = v; uv1.val[0][2] = 1;
-  Matrix lambda(3,1);
-  Matrix ainv(t.Ainv);
-  lambda = ainv * uv1;
-#if 0  
-  std::cout << "uv1:    " << uv1 << std::endl;
-  std::cout << "ainv:   " << ainv << std::endl;
-  std::cout << "lambda: " << lambda << std::endl;
-#endif  
-  if (lambda.val[0][0] >=   0 && lambda.val[0][0] <= 1.0 &&
-      lambda.val[1][0] >=   0 && lambda.val[1][0] <= 1.0 &&
-      lambda.val[2][0] >=   0 && lambda.val[2][0] <= 1.0) {
-    return (lambda.val[0][0] * pts[t.c[0]].d +
-            lambda.val[1][0] * pts[t.c[1]].d +
-            lambda.val[2][0] * pts[t.c[2]].d);
-  }
-  return (-1.0);
-}
-
 int32_t *Elas::findDisparityLimits(const std::vector<Elas::support_pt> &pts,
                                    const std::vector<Elas::sparse_triangle> &tri) const {
   //
   // set up and allocate grid
   //
-  int32_t ss = param.candidate_stepsize;
-  if (param.subsampling) {
-    ss += ss % 2;
-  }
+  int32_t ss = candidateStepsize();
   int32_t D_can_width  = (width  + ss - 1) / ss;
   int32_t D_can_height = (height + ss - 1) / ss;
 
@@ -542,24 +554,63 @@ int32_t *Elas::findDisparityLimits(const std::vector<Elas::support_pt> &pts,
   }
 
   //
-  // find depth limits
+  // find depth limits by scanline rasterization of each triangle
+  // over the candidate grid. The rows of Ainv are the barycentric
+  // edge functions lambda_k(u,v) = e_k[0]*u + e_k[1]*v + e_k[2],
+  // and the disparity plane is d(u,v) = sum_k lambda_k(u,v)*d_k.
   //
-  
+  const double eps = 1e-9;  // keep grid points lying exactly on an edge
   for (int i = 0; i < tri.size(); i++) {
     const Elas::sparse_triangle &t = tri[i];
-    int umin = min(min(pts[t.cidx[0]].u, pts[t.cidx[1]].u), pts[t.cidx[2]].u);
-    int umax = max(max(pts[t.cidx[0]].u, pts[t.cidx[1]].u), pts[t.cidx[2]].u);
-    int vmin = min(min(pts[t.cidx[0]].v, pts[t.cidx[1]].v), pts[t.cidx[2]].v);
-    int vmax = max(max(pts[t.cidx[0]].v, pts[t.cidx[1]].v), pts[t.cidx[2]].v);
-    const int ucan_start(umin/ss), ucan_end(umax/ss);
-    const int vcan_start(vmin/ss), vcan_end(vmax/ss);
-    for (int ucan = ucan_start; ucan < ucan_end; ucan++) {
-      for (int vcan = vcan_start; vcan < vcan_end; vcan++) {
-        float d = get_depth(pts, t, ucan * ss, vcan * ss);
+    const support_pt &p0 = pts[t.cidx[0]];
+    const support_pt &p1 = pts[t.cidx[1]];
+    const support_pt &p2 = pts[t.cidx[2]];
+
+    // degenerate triangles have no valid barycentric inverse
+    if ((p1.u-p0.u)*(p2.v-p0.v) - (p2.u-p0.u)*(p1.v-p0.v) == 0)
+      continue;
+
+    const double d0 = p0.d, d1 = p1.d, d2 = p2.d;
+    const double *e[3] = {t.Ainv.val[0], t.Ainv.val[1], t.Ainv.val[2]};
+    const double plane_a = e[0][0]*d0 + e[1][0]*d1 + e[2][0]*d2;
+    const double plane_b = e[0][1]*d0 + e[1][1]*d1 + e[2][1]*d2;
+    const double plane_c = e[0][2]*d0 + e[1][2]*d1 + e[2][2]*d2;
+
+    // inclusive bounding box in candidate grid coordinates, clipped to grid
+    const int umin = min(min(p0.u, p1.u), p2.u);
+    const int umax = max(max(p0.u, p1.u), p2.u);
+    const int vmin = min(min(p0.v, p1.v), p2.v);
+    const int vmax = max(max(p0.v, p1.v), p2.v);
+    if (umax < 0 || vmax < 0)
+      continue;
+    const int vcan_start = max((vmin + ss - 1) / ss, 0);
+    const int vcan_end   = min(vmax / ss, D_can_height - 1);
+
+    for (int vcan = vcan_start; vcan <= vcan_end; vcan++) {
+      const double v = vcan * ss;
+
+      // intersect the three half planes lambda_k >= 0 with this row
+      double ulo = umin, uhi = umax;
+      bool empty = false;
+      for (int k = 0; k < 3; k++) {
+        const double off = e[k][1]*v + e[k][2];
+        if (e[k][0] > 0)      ulo = max(ulo, (-eps - off)/e[k][0]);
+        else if (e[k][0] < 0) uhi = min(uhi, (-eps - off)/e[k][0]);
+        else if (off < -eps)  empty = true;
+      }
+      if (empty || uhi < ulo || uhi < 0)
+        continue;
+      const int ucan_start = max((int)ceil(ulo / ss), 0);
+      const int ucan_end   = min((int)floor(uhi / ss), D_can_width - 1);
+
+      // walk the span and evaluate the disparity plane
+      const double d_row = plane_b*v + plane_c;
+      int32_t *lim = lim_grid + 2 * getAddressOffsetImage(ucan_start, vcan, D_can_width);
+      for (int ucan = ucan_start; ucan <= ucan_end; ucan++, lim += 2) {
+        const double d = plane_a*(ucan*ss) + d_row;
         if (d >= 0) {
-          int addr = getAddressOffsetImage(ucan, vcan, D_can_width);
-          lim_grid[2 * addr]     = max(0, (int) (d - 1.0));
-          lim_grid[2 * addr + 1] = min(param.disp_max, (int) (d + 1.0));
+          lim[0] = max(0, (int) (d - 1.0));
+          lim[1] = min(param.disp_max, (int) (d + 1.0));
         }
       }
     }
@@ -569,10 +620,7 @@ int32_t *Elas::findDisparityLimits(const std::vector<Elas::support_pt> &pts,
 
 
 int16_t *Elas::filterSupportPoints() {
-  int32_t ss = param.candidate_stepsize;
-  if (param.subsampling) {
-    ss += ss % 2;
-  }
+  int32_t ss = candidateStepsize();
   int32_t D_can_width  = (width  + ss - 1) / ss;
   int32_t D_can_height = (height + ss - 1) / ss;
 
@@ -616,11 +664,9 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t* I1_desc,uint8_t* I
                                                      const int32_t *disp_lim,
                                                      const std::vector<support_pt> &oldpts,
                                                      const std::vector<sparse_triangle> &oldtri) {
-  // be sure that at half resolution we only need data
-  // from every second line!
-  int32_t D_candidate_stepsize = param.candidate_stepsize;
-  if (param.subsampling)
-    D_candidate_stepsize += D_candidate_stepsize%2;
+  // be sure that with subsampling we only need data
+  // from every step-th line!
+  int32_t D_candidate_stepsize = candidateStepsize();
 
   // create matrix for saving disparity candidates
   int32_t D_can_width  = (width + D_candidate_stepsize - 1) / D_candidate_stepsize;
@@ -697,152 +743,477 @@ vector<Elas::support_pt> Elas::computeSupportMatches(uint8_t* I1_desc,uint8_t* I
   return p_support; 
 }
 
-vector<Elas::triangle> Elas::computeDelaunayTriangulation (const vector<support_pt> &p_support,int32_t right_image) {
-  // input/output structure for triangulation
-  struct triangulateio in, out;
-  int32_t k;
-  // inputs
-  in.numberofpoints = p_support.size();
-  in.pointlist = (float*)malloc(in.numberofpoints*2*sizeof(float));
-  k=0;
+static Elas::triangle make_triangle (const vector<Elas::support_pt> &p_support,int32_t c1,int32_t c2,int32_t c3) {
+  Elas::triangle t(c1,c2,c3);
+  const Elas::support_pt &p1 = p_support[c1];
+  const Elas::support_pt &p2 = p_support[c2];
+  const Elas::support_pt &p3 = p_support[c3];
+  Matrix33 A = Matrix33::fromColumns(Vector3(p1.u,p1.v,1),Vector3(p2.u,p2.v,1),Vector3(p3.u,p3.v,1));
+  A.inv(t.Ainv);
+  return t;
+}
+
+void Elas::computeDelaunayTriangulation (const vector<support_pt> &p_support,int32_t right_image,vector<triangle> &tri) {
+  // left image support points lie on the candidate lattice
+  if (!right_image && param.lattice_triangulation && computeLatticeTriangulation(p_support,tri))
+    return;
+
+  // the context keeps Triangle's pools and buffers alive across frames
+  // (z=zero-based, Q=quiet, B=no boundary markers)
+  if (tri_ctx_==NULL) {
+    char parameters[] = "zQB";
+    tri_ctx_ = triangulatecontextnew(parameters);
+  }
+  // write points directly into the context's input buffer
+  float *pointlist = triangulatecontextpoints(tri_ctx_,p_support.size());
+  int32_t k=0;
   if (!right_image) {
     for (int32_t i=0; i<p_support.size(); i++) {
-      in.pointlist[k++] = p_support[i].u;
-      in.pointlist[k++] = p_support[i].v;
+      pointlist[k++] = p_support[i].u;
+      pointlist[k++] = p_support[i].v;
     }
   } else {
     for (int32_t i=0; i<p_support.size(); i++) {
-      in.pointlist[k++] = p_support[i].u-p_support[i].d;
-      in.pointlist[k++] = p_support[i].v;
+      pointlist[k++] = p_support[i].u-p_support[i].d;
+      pointlist[k++] = p_support[i].v;
     }
   }
-  in.numberofpointattributes = 0;
-  in.pointattributelist      = NULL;
-  in.pointmarkerlist         = NULL;
-  in.numberofsegments        = 0;
-  in.numberofholes           = 0;
-  in.numberofregions         = 0;
-  in.regionlist              = NULL;
-  
-  // outputs
-  out.pointlist              = NULL;
-  out.pointattributelist     = NULL;
-  out.pointmarkerlist        = NULL;
-  out.trianglelist           = NULL;
-  out.triangleattributelist  = NULL;
-  out.neighborlist           = NULL;
-  out.segmentlist            = NULL;
-  out.segmentmarkerlist      = NULL;
-  out.edgelist               = NULL;
-  out.edgemarkerlist         = NULL;
-  // do triangulation (z=zero-based, n=neighbors, Q=quiet, B=no boundary markers)
-  char parameters[] = "zQB";
-  triangulate(parameters, &in, &out, NULL);
-  // put resulting triangles into vector tri
-  vector<triangle> tri;
+  // do triangulation
+  int *trianglelist;
+  int32_t num_triangles = triangulatecontextrun(tri_ctx_,p_support.size(),&trianglelist);
+  // put resulting triangles into vector tri (keeps its capacity)
+  tri.clear();
+  tri.reserve(num_triangles);
   k=0;
-  for (int32_t i=0; i<out.numberoftriangles; i++) {
-    triangle t(out.trianglelist[k],out.trianglelist[k+1],out.trianglelist[k+2]);
-    Matrix A(3,3);
-    A.val[0][0] = p_support[t.c1].u; A.val[1][0] = p_support[t.c1].v; A.val[2][0] = 1;
-    A.val[0][1] = p_support[t.c2].u; A.val[1][1] = p_support[t.c2].v; A.val[2][1] = 1;
-    A.val[0][2] = p_support[t.c3].u; A.val[1][2] = p_support[t.c3].v; A.val[2][2] = 1;
-    t.Ainv = Matrix::inv(A);
-    tri.push_back(t);
+  for (int32_t i=0; i<num_triangles; i++) {
+    tri.push_back(make_triangle(p_support,trianglelist[k],trianglelist[k+1],trianglelist[k+2]));
     k+=3;
   }
-  
-  // free memory used for triangulation
-  free(in.pointlist);
-  free(out.pointlist);
-  free(out.trianglelist);
-  
-  // return triangles
-  return tri;
 }
 
+bool Elas::computeLatticeTriangulation (const vector<support_pt> &p_support,vector<triangle> &tri) {
+
+  // lattice of computeSupportMatches()
+  int32_t step = candidateStepsize();
+  if (step<=0)
+    return false;
+
+  // split into lattice and off-lattice points (corners, projected points),
+  // leave inputs which are not near-grid to Triangle
+  lattice_u_.clear(); lattice_v_.clear();
+  lattice_pts_.clear(); lattice_off_.clear();
+  for (int32_t i=0; i<(int32_t)p_support.size(); i++) {
+    const support_pt &p = p_support[i];
+    if (p.u>=0 && p.v>=0 && p.u%step==0 && p.v%step==0) {
+      lattice_u_.push_back(p.u);
+      lattice_v_.push_back(p.v);
+      lattice_pts_.push_back(i);
+    } else {
+      lattice_off_.push_back(i);
+    }
+  }
+  if (4*lattice_off_.size()>p_support.size())
+    return false;
+
+  // triangulate the lattice points in linear time
+  if (!lattice_.buildLattice(lattice_u_,lattice_v_,step,lattice_handle_))
+    return false;
+  lattice_index_.assign(lattice_.numVertexHandles(),-1);
+  for (int32_t k=0; k<(int32_t)lattice_pts_.size(); k++)
+    if (lattice_handle_[k]>=0)
+      lattice_index_[lattice_handle_[k]] = lattice_pts_[k];
+
+  // insert the few off-lattice points, Triangle takes over if one fails
+  for (int32_t k=0; k<(int32_t)lattice_off_.size(); k++) {
+    const support_pt &p = p_support[lattice_off_[k]];
+    int32_t vtx = lattice_.insert(p.u,p.v);
+    if (vtx<0)
+      return false;
+    if (vtx>=(int32_t)lattice_index_.size())
+      lattice_index_.resize(vtx+1,-1);
+    lattice_index_[vtx] = lattice_off_[k];
+  }
 
-void Elas::computeDisparityPlanes (vector<support_pt> p_support,vector<triangle> &tri,int32_t right_image) {
+  // put resulting triangles into vector tri (keeps its capacity)
+  lattice_.getTriangles(lattice_corners_);
+  tri.clear();
+  tri.reserve(lattice_corners_.size()/3);
+  for (int32_t k=0; k<(int32_t)lattice_corners_.size(); k+=3)
+    tri.push_back(make_triangle(p_support,lattice_index_[lattice_corners_[k]],
+                                lattice_index_[lattice_corners_[k+1]],lattice_index_[lattice_corners_[k+2]]));
+  return true;
+}
 
-  // init matrices
-  Matrix A(3,3);
-  Matrix b(3,1);
-  
-  // for all triangles do
-  for (int32_t i=0; i<tri.size(); i++) {
-    
-    // get triangle corner indices
-    int32_t c1 = tri[i].c1;
-    int32_t c2 = tri[i].c2;
-    int32_t c3 = tri[i].c3;
-    
-    // compute matrix A for linear system of left triangle
-    A.val[0][0] = p_support[c1].u;
-    A.val[1][0] = p_support[c2].u;
-    A.val[2][0] = p_support[c3].u;
-    A.val[0][1] = p_support[c1].v; A.val[0][2] = 1;
-    A.val[1][1] = p_support[c2].v; A.val[1][2] = 1;
-    A.val[2][1] = p_support[c3].v; A.val[2][2] = 1;
-    
-    // compute vector b for linear system (containing the disparities)
-    b.val[0][0] = p_support[c1].d;
-    b.val[1][0] = p_support[c2].d;
-    b.val[2][0] = p_support[c3].d;
-    
-    // on success of gauss jordan elimination
-    if (b.solve(A)) {
-      
-      // grab results from b
-      tri[i].t1a = b.val[0][0];
-      tri[i].t1b = b.val[1][0];
-      tri[i].t1c = b.val[2][0];
-      
-    // otherwise: invalid
-    } else {
-      tri[i].t1a = 0;
-      tri[i].t1b = 0;
-      tri[i].t1c = 0;
+void Elas::computeIncrementalTriangulation (const vector<support_pt> &p_support,vector<triangle> &tri) {
+
+  // current points sorted by id (only the first of equal ids is
+  // triangulated); surviving points keep their order and new ones get
+  // larger ids, so the points usually arrive sorted already
+  const int32_t num_pts = p_support.size();
+  delaunay_sorted_.resize(num_pts);
+  for (int32_t i=0; i<num_pts; i++)
+    delaunay_sorted_[i] = make_pair(p_support[i].id,i);
+  if (!is_sorted(delaunay_sorted_.begin(),delaunay_sorted_.end()))
+    sort(delaunay_sorted_.begin(),delaunay_sorted_.end());
+
+  // start from scratch if there is no previous triangulation
+  bool rebuild = delaunay_ids_.empty();
+
+  delaunay_next_.clear();
+  delaunay_relocate_.clear();
+  if (!rebuild) {
+
+    // merge old and current points by id: remove vanished points,
+    // move the surviving ones and insert new ones afterwards
+    const int32_t num_old = delaunay_ids_.size();
+    int32_t j = 0;
+    for (int32_t i=0; i<num_pts; i++) {
+      uint64_t id = delaunay_sorted_[i].first;
+      if (i>0 && delaunay_sorted_[i-1].first==id)
+        continue;
+      while (j<num_old && delaunay_ids_[j].first<id)
+        delaunay_.remove(delaunay_ids_[j++].second);
+      int32_t vtx = -1;
+      if (j<num_old && delaunay_ids_[j].first==id)
+        vtx = delaunay_ids_[j++].second;
+      delaunay_next_.push_back(make_pair(id,vtx));
     }
+    while (j<num_old)
+      delaunay_.remove(delaunay_ids_[j++].second);
+
+    // move the surviving points (Delaunay::move ignores points which did
+    // not move), points whose motion would invert a triangle are
+    // re-inserted after the flips
+    for (int32_t i=0,k=0; i<num_pts; i++) {
+      if (i>0 && delaunay_sorted_[i-1].first==delaunay_sorted_[i].first)
+        continue;
+      const support_pt &p = p_support[delaunay_sorted_[i].second];
+      if (delaunay_next_[k].second>=0 && !delaunay_.move(delaunay_next_[k].second,p.u,p.v)) {
+        delaunay_relocate_.push_back(delaunay_next_[k].second);
+        delaunay_next_[k].second = -1;
+      }
+      k++;
+    }
+    delaunay_.legalize();
+    for (int32_t i=0; i<(int32_t)delaunay_relocate_.size(); i++)
+      delaunay_.remove(delaunay_relocate_[i]);
 
-    // compute matrix A for linear system of right triangle
-    A.val[0][0] = p_support[c1].u-p_support[c1].d;
-    A.val[1][0] = p_support[c2].u-p_support[c2].d;
-    A.val[2][0] = p_support[c3].u-p_support[c3].d;
-    A.val[0][1] = p_support[c1].v; A.val[0][2] = 1;
-    A.val[1][1] = p_support[c2].v; A.val[1][2] = 1;
-    A.val[2][1] = p_support[c3].v; A.val[2][2] = 1;
-    
-    // compute vector b for linear system (containing the disparities)
-    b.val[0][0] = p_support[c1].d;
-    b.val[1][0] = p_support[c2].d;
-    b.val[2][0] = p_support[c3].d;
-    
-    // on success of gauss jordan elimination
-    if (b.solve(A)) {
-      
-      // grab results from b
-      tri[i].t2a = b.val[0][0];
-      tri[i].t2b = b.val[1][0];
-      tri[i].t2c = b.val[2][0];
-      
-    // otherwise: invalid
-    } else {
-      tri[i].t2a = 0;
-      tri[i].t2b = 0;
-      tri[i].t2c = 0;
+  } else {
+    delaunay_.reset();
+    for (int32_t i=0; i<num_pts; i++) {
+      if (i>0 && delaunay_sorted_[i-1].first==delaunay_sorted_[i].first)
+        continue;
+      delaunay_next_.push_back(make_pair(delaunay_sorted_[i].first,-1));
     }
-  }  
+  }
+
+  // insert new points (and relocated or previously duplicate ones)
+  for (int32_t i=0,k=0; i<num_pts; i++) {
+    if (i>0 && delaunay_sorted_[i-1].first==delaunay_sorted_[i].first)
+      continue;
+    const support_pt &p = p_support[delaunay_sorted_[i].second];
+    if (delaunay_next_[k].second<0)
+      delaunay_next_[k].second = delaunay_.insert(p.u,p.v);
+    k++;
+  }
+  delaunay_ids_.swap(delaunay_next_);
+
+  // map vertex handles to point indices and collect the triangles
+  delaunay_index_.assign(delaunay_.numVertexHandles(),-1);
+  for (int32_t i=0,k=0; i<num_pts; i++) {
+    if (i>0 && delaunay_sorted_[i-1].first==delaunay_sorted_[i].first)
+      continue;
+    if (delaunay_ids_[k].second>=0)
+      delaunay_index_[delaunay_ids_[k].second] = delaunay_sorted_[i].second;
+    k++;
+  }
+  delaunay_.getTriangles(delaunay_corners_);
+  tri.clear();
+  tri.reserve(delaunay_corners_.size()/3);
+  for (int32_t k=0; k<(int32_t)delaunay_corners_.size(); k+=3)
+    tri.push_back(make_triangle(p_support,delaunay_index_[delaunay_corners_[k]],
+                                delaunay_index_[delaunay_corners_[k+1]],
+                                delaunay_index_[delaunay_corners_[k+2]]));
+}
+
+// right plane of triangle i solved directly from its right image corners
+// (used if the triangle is degenerate in the left image)
+static void right_plane_direct (Elas::triangle_table &tab,int32_t i) {
+  Matrix33 A = Matrix33::fromColumns(Vector3(tab.u1[i]-tab.d1[i],tab.u2[i]-tab.d2[i],tab.u3[i]-tab.d3[i]),
+                                     Vector3(tab.v1[i],tab.v2[i],tab.v3[i]),Vector3(1,1,1));
+  Vector3 x(0,0,0);
+  A.solve(Vector3(tab.d1[i],tab.d2[i],tab.d3[i]),x);
+  tab.t2a[i] = x.val[0];
+  tab.t2b[i] = x.val[1];
+  tab.t2c[i] = x.val[2];
+}
+
+// planes of triangle i (scalar, for the tail of the batched fit)
+static void plane_fit1 (const vector<Elas::triangle> &tri,Elas::triangle_table &tab,int32_t i) {
+
+  // left plane: Ainv already holds the inverse of the [u v 1]' corner
+  // matrix, hence (a,b,c) = (d1,d2,d3)*Ainv
+  const double d1 = tab.d1[i], d2 = tab.d2[i], d3 = tab.d3[i];
+  const double (*Ai)[3] = tri[i].Ainv.val;
+  const double a = d1*Ai[0][0] + d2*Ai[1][0] + d3*Ai[2][0];
+  const double b = d1*Ai[0][1] + d2*Ai[1][1] + d3*Ai[2][1];
+  const double c = d1*Ai[0][2] + d2*Ai[1][2] + d3*Ai[2][2];
+  const bool left_valid = (tab.u2[i]-tab.u1[i])*(tab.v3[i]-tab.v1[i]) !=
+                          (tab.u3[i]-tab.u1[i])*(tab.v2[i]-tab.v1[i]);
+  tab.t1a[i] = left_valid ? a : 0;
+  tab.t1b[i] = left_valid ? b : 0;
+  tab.t1c[i] = left_valid ? c : 0;
+
+  // right plane: substituting u = u'+d into d = a*u+b*v+c gives
+  // d = (a*u'+b*v+c)/(1-a), singular exactly when the right triangle is
+  if (left_valid) {
+    const double s = 1.0-a;
+    tab.t2a[i] = fabs(s)>1e-20 ? a/s : 0;
+    tab.t2b[i] = fabs(s)>1e-20 ? b/s : 0;
+    tab.t2c[i] = fabs(s)>1e-20 ? c/s : 0;
+  } else {
+    right_plane_direct(tab,i);
+  }
+}
+
+// planes of the triangles i..i+3, the same arithmetic as plane_fit1 in
+// double lanes (so results are identical); returns a bit mask of the
+// triangles that are degenerate in the left image and still need
+// right_plane_direct
+#ifdef __AVX2__
+static inline __m256d load4_pd (const vector<int32_t> &x,int32_t i) {
+  return _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(x.data()+i)));
+}
+
+static inline __m256d gather4_pd (const vector<Elas::triangle> &tri,int32_t i,int32_t r,int32_t c) {
+  return _mm256_set_pd(tri[i+3].Ainv.val[r][c],tri[i+2].Ainv.val[r][c],
+                       tri[i+1].Ainv.val[r][c],tri[i].Ainv.val[r][c]);
 }
 
-void Elas::createGrid(vector<support_pt> p_support,int32_t* disparity_grid,int32_t* grid_dims,bool right_image) {
+static inline int32_t plane_fit4 (const vector<Elas::triangle> &tri,Elas::triangle_table &tab,int32_t i) {
+
+  const __m256d d1 = load4_pd(tab.d1,i), d2 = load4_pd(tab.d2,i), d3 = load4_pd(tab.d3,i);
+  const __m256d u1 = load4_pd(tab.u1,i), u2 = load4_pd(tab.u2,i), u3 = load4_pd(tab.u3,i);
+  const __m256d v1 = load4_pd(tab.v1,i), v2 = load4_pd(tab.v2,i), v3 = load4_pd(tab.v3,i);
+
+  // left plane and orientation test (products of pixel coordinates are
+  // exact in double)
+  __m256d pl[3];
+  for (int32_t k=0; k<3; k++)
+    pl[k] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(d1,gather4_pd(tri,i,0,k)),
+                                        _mm256_mul_pd(d2,gather4_pd(tri,i,1,k))),
+                          _mm256_mul_pd(d3,gather4_pd(tri,i,2,k)));
+  const __m256d valid = _mm256_cmp_pd(_mm256_mul_pd(_mm256_sub_pd(u2,u1),_mm256_sub_pd(v3,v1)),
+                                      _mm256_mul_pd(_mm256_sub_pd(u3,u1),_mm256_sub_pd(v2,v1)),_CMP_NEQ_UQ);
+
+  // right plane
+  const __m256d s  = _mm256_sub_pd(_mm256_set1_pd(1.0),pl[0]);
+  const __m256d ok = _mm256_and_pd(valid,_mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.0),s),
+                                                       _mm256_set1_pd(1e-20),_CMP_GT_OQ));
+  float *t1[3] = {tab.t1a.data()+i,tab.t1b.data()+i,tab.t1c.data()+i};
+  float *t2[3] = {tab.t2a.data()+i,tab.t2b.data()+i,tab.t2c.data()+i};
+  for (int32_t k=0; k<3; k++) {
+    _mm_storeu_ps(t1[k],_mm256_cvtpd_ps(_mm256_and_pd(valid,pl[k])));
+    _mm_storeu_ps(t2[k],_mm256_cvtpd_ps(_mm256_and_pd(ok,_mm256_div_pd(pl[k],s))));
+  }
+  return ~_mm256_movemask_pd(valid)&15;
+}
+#else
+static inline __m128d load2_pd (const vector<int32_t> &x,int32_t i) {
+  return _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(x.data()+i)));
+}
+
+static inline __m128d gather2_pd (const vector<Elas::triangle> &tri,int32_t i,int32_t r,int32_t c) {
+  return _mm_set_pd(tri[i+1].Ainv.val[r][c],tri[i].Ainv.val[r][c]);
+}
+
+// triangles i and i+1
+static inline int32_t plane_fit2 (const vector<Elas::triangle> &tri,Elas::triangle_table &tab,int32_t i) {
+
+  const __m128d d1 = load2_pd(tab.d1,i), d2 = load2_pd(tab.d2,i), d3 = load2_pd(tab.d3,i);
+  const __m128d u1 = load2_pd(tab.u1,i), u2 = load2_pd(tab.u2,i), u3 = load2_pd(tab.u3,i);
+  const __m128d v1 = load2_pd(tab.v1,i), v2 = load2_pd(tab.v2,i), v3 = load2_pd(tab.v3,i);
+
+  // left plane and orientation test (products of pixel coordinates are
+  // exact in double)
+  __m128d pl[3];
+  for (int32_t k=0; k<3; k++)
+    pl[k] = _mm_add_pd(_mm_add_pd(_mm_mul_pd(d1,gather2_pd(tri,i,0,k)),
+                                  _mm_mul_pd(d2,gather2_pd(tri,i,1,k))),
+                       _mm_mul_pd(d3,gather2_pd(tri,i,2,k)));
+  const __m128d valid = _mm_cmpneq_pd(_mm_mul_pd(_mm_sub_pd(u2,u1),_mm_sub_pd(v3,v1)),
+                                      _mm_mul_pd(_mm_sub_pd(u3,u1),_mm_sub_pd(v2,v1)));
+
+  // right plane
+  const __m128d s  = _mm_sub_pd(_mm_set1_pd(1.0),pl[0]);
+  const __m128d ok = _mm_and_pd(valid,_mm_cmpgt_pd(_mm_andnot_pd(_mm_set1_pd(-0.0),s),_mm_set1_pd(1e-20)));
+  float *t1[3] = {tab.t1a.data()+i,tab.t1b.data()+i,tab.t1c.data()+i};
+  float *t2[3] = {tab.t2a.data()+i,tab.t2b.data()+i,tab.t2c.data()+i};
+  for (int32_t k=0; k<3; k++) {
+    _mm_storel_pi((__m64*)t1[k],_mm_cvtpd_ps(_mm_and_pd(valid,pl[k])));
+    _mm_storel_pi((__m64*)t2[k],_mm_cvtpd_ps(_mm_and_pd(ok,_mm_div_pd(pl[k],s))));
+  }
+  return ~_mm_movemask_pd(valid)&3;
+}
+
+static inline int32_t plane_fit4 (const vector<Elas::triangle> &tri,Elas::triangle_table &tab,int32_t i) {
+  return plane_fit2(tri,tab,i) | plane_fit2(tri,tab,i+2)<<2;
+}
+#endif
+
+void Elas::computeDisparityPlanes (const vector<support_pt> &p_support,const vector<triangle> &tri,triangle_table &tab,
+                                   const uint8_t* I_desc,bool right_image) {
+
+  // resize table (keeps capacity from previous frames)
+  const int32_t n = tri.size();
+  tab.u1.resize(n);  tab.u2.resize(n);  tab.u3.resize(n);
+  tab.v1.resize(n);  tab.v2.resize(n);  tab.v3.resize(n);
+  tab.d1.resize(n);  tab.d2.resize(n);  tab.d3.resize(n);
+  tab.t1a.resize(n); tab.t1b.resize(n); tab.t1c.resize(n);
+  tab.t2a.resize(n); tab.t2b.resize(n); tab.t2c.resize(n);
+
+  // corners
+  for (int32_t i=0; i<n; i++) {
+    const triangle   &t  = tri[i];
+    const support_pt &p1 = p_support[t.c1];
+    const support_pt &p2 = p_support[t.c2];
+    const support_pt &p3 = p_support[t.c3];
+    tab.u1[i] = p1.u; tab.u2[i] = p2.u; tab.u3[i] = p3.u;
+    tab.v1[i] = p1.v; tab.v2[i] = p2.v; tab.v3[i] = p3.v;
+    tab.d1[i] = p1.d; tab.d2[i] = p2.d; tab.d3[i] = p3.d;
+  }
+
+  // planes, four triangles at a time (the Ainv gathers are the only
+  // strided loads, everything else comes from the table)
+  int32_t i = 0;
+  for (; i+4<=n; i+=4) {
+    const int32_t degenerate = plane_fit4(tri,tab,i);
+    for (int32_t k=0; k<4; k++)
+      if (degenerate&(1<<k))
+        right_plane_direct(tab,i+k);
+  }
+  for (; i<n; i++)
+    plane_fit1(tri,tab,i);
+
+  // planar triangles are filled by interpolation
+  tab.planar.assign(n,0);
+  if (param.plane_fill_threshold>0)
+    markPlanarTriangles(p_support,tri,tab,I_desc,right_image);
+}
+
+// texture of a descriptor, as tested against match_texture
+static inline int32_t patch_texture (const uint8_t* I_block) {
+  int32_t sum = 0;
+  for (int32_t i=0; i<16; i++)
+    sum += abs((int32_t)I_block[i]-128);
+  return sum;
+}
+
+// corner e%3 of triangle e/3
+static inline int32_t triangle_corner (const vector<Elas::triangle> &tri,int32_t e) {
+  const Elas::triangle &t = tri[e/3];
+  return e%3==0 ? t.c1 : (e%3==1 ? t.c2 : t.c3);
+}
+
+void Elas::markPlanarTriangles (const vector<support_pt> &p_support,const vector<triangle> &tri,triangle_table &tab,
+                                const uint8_t* I_desc,bool right_image) {
+
+  // key all edges by their corner indices, so that the two triangles
+  // sharing an edge are adjacent after sorting (the edge opposite to
+  // corner k of triangle i is stored as 3*i+k)
+  const int32_t n       = tri.size();
+  const int64_t num_pts = p_support.size();
+  vector<pair<int64_t,int32_t> > &edges = planar_edges_;
+  edges.resize(3*n);
+  for (int32_t e=0; e<3*n; e++) {
+    int64_t a = triangle_corner(tri,e-e%3+(e+1)%3);
+    int64_t b = triangle_corner(tri,e-e%3+(e+2)%3);
+    edges[e] = make_pair(min(a,b)*num_pts+max(a,b),e);
+  }
+  sort(edges.begin(),edges.end());
+
+  // count the neighbours whose far corner lies on the plane of a triangle,
+  // planarity is preserved between the views, so the left plane is checked
+  vector<int32_t> &num_planar = planar_count_;
+  num_planar.assign(n,0);
+  for (int32_t j=0; j+1<3*n; j++) {
+    if (edges[j].first!=edges[j+1].first)
+      continue;
+    int32_t e[2] = {edges[j].second,edges[j+1].second};
+    for (int32_t k=0; k<2; k++) {
+      int32_t i = e[k]/3;
+      const support_pt &p = p_support[triangle_corner(tri,e[1-k])];
+      if (fabs(tab.t1a[i]*p.u+tab.t1b[i]*p.v+tab.t1c[i]-p.d)<=param.plane_fill_threshold)
+        num_planar[i]++;
+    }
+    j++;
+  }
+
+  // only triangles enclosed by planar neighbours are filled, and only if
+  // they lack texture: most of seven samples (centroid, edge midpoints and
+  // halfway to the corners) fail the texture test of findMatch, so matching
+  // would leave them invalid anyway. Textured triangles are still matched.
+  static const float w[7][3] = {{1/3.0f,1/3.0f,1/3.0f},{0.5f,0.5f,0},{0,0.5f,0.5f},{0.5f,0,0.5f},
+                                {2/3.0f,1/6.0f,1/6.0f},{1/6.0f,2/3.0f,1/6.0f},{1/6.0f,1/6.0f,2/3.0f}};
+  const int32_t step = subsamplingStep();
+  for (int32_t i=0; i<n; i++) {
+    tab.planar[i] = 0;
+    if (num_planar[i]<3)
+      continue;
+    const float u[3] = {(float)(tab.u1[i]-(right_image ? tab.d1[i] : 0)),
+                        (float)(tab.u2[i]-(right_image ? tab.d2[i] : 0)),
+                        (float)(tab.u3[i]-(right_image ? tab.d3[i] : 0))};
+    const float v[3] = {(float)tab.v1[i],(float)tab.v2[i],(float)tab.v3[i]};
+    int32_t num_textured = 0;
+    for (int32_t k=0; k<7; k++) {
+      int32_t u_s = min(max((int32_t)(w[k][0]*u[0]+w[k][1]*u[1]+w[k][2]*u[2]),0),width-1);
+      int32_t v_s = (int32_t)(w[k][0]*v[0]+w[k][1]*v[1]+w[k][2]*v[2]);
+      const uint8_t* I_block = I_desc+16*(width*(max(min(v_s,height-3),2)/step)+u_s);
+      if (patch_texture(I_block)>=param.match_texture)
+        num_textured++;
+    }
+    tab.planar[i] = num_textured<4;
+  }
+}
+
+// index of the lowest set bit (w!=0)
+static inline int32_t lowest_bit (uint64_t w) {
+#ifdef _MSC_VER
+  unsigned long b;
+  _BitScanForward64(&b,w);
+  return b;
+#else
+  return __builtin_ctzll(w);
+#endif
+}
+
+// number of set bits
+static inline int32_t count_bits (uint64_t w) {
+#ifdef _MSC_VER
+  return (int32_t)__popcnt64(w);
+#else
+  return __builtin_popcountll(w);
+#endif
+}
+
+template <typename T>
+void Elas::createGrid(const vector<support_pt> &p_support,vector<T> &grid_cand,vector<uint32_t> &grid_offset,
+                      int32_t* grid_dims,bool right_image) {
   
   // get grid dimensions
+  int32_t disp_num    = grid_dims[0];
+  int32_t disp_min    = max(param.disp_min,0);
   int32_t grid_width  = grid_dims[1];
   int32_t grid_height = grid_dims[2];
+  int32_t num_cells   = grid_width*grid_height;
   
-  // allocate temporary memory
-  int32_t* temp1 = (int32_t*)calloc((param.disp_max+1)*grid_height*grid_width,sizeof(int32_t));
-  int32_t* temp2 = (int32_t*)calloc((param.disp_max+1)*grid_height*grid_width,sizeof(int32_t));
+  // the candidate disparities (minus disp_min) of each cell are a bit mask
+  // of 64-bit words, padded to a multiple of 256 bits for the SIMD diffusion
+  const int32_t words = ((disp_num+255)/256)*4;
+  grid_mask_.assign(words*num_cells,0);
+  grid_diffused_.assign(words*num_cells,0);
+  uint64_t* temp1 = grid_mask_.data();
+  uint64_t* temp2 = grid_diffused_.data();
   
   // for all support points do
   for (int32_t i=0; i<p_support.size(); i++) {
@@ -851,69 +1222,71 @@ void Elas::createGrid(vector<support_pt> p_support,int32_t* disparity_grid,int32
     int32_t x_curr = p_support[i].u;
     int32_t y_curr = p_support[i].v;
     int32_t d_curr = p_support[i].d;
-    int32_t d_min  = max(d_curr-1,0);
+    int32_t d_min  = max(d_curr-1,disp_min);
     int32_t d_max  = min(d_curr+1,param.disp_max);
     
-    // fill disparity grid helper
-    for (int32_t d=d_min; d<=d_max; d++) {
-      int32_t x;
-      if (!right_image)
-        x = floor((float)(x_curr/param.grid_size));
-      else
-        x = floor((float)(x_curr-d_curr)/(float)param.grid_size);
-      int32_t y = floor((float)y_curr/(float)param.grid_size);
-      
-      // point may potentially lay outside (corner points)
-      if (x>=0 && x<grid_width &&y>=0 && y<grid_height) {
-        int32_t addr = getAddressOffsetGrid(x,y,d,grid_width,param.disp_max+1);
-        *(temp1+addr) = 1;
-      }
+    // grid cell of this support point
+    int32_t x;
+    if (!right_image)
+      x = floor((float)(x_curr/param.grid_size));
+    else
+      x = floor((float)(x_curr-d_curr)/(float)param.grid_size);
+    int32_t y = floor((float)y_curr/(float)param.grid_size);
+    
+    // point may potentially lay outside (corner points)
+    if (x>=0 && x<grid_width && y>=0 && y<grid_height) {
+      uint64_t* mask = temp1+(y*grid_width+x)*words;
+      for (int32_t d=d_min-disp_min; d<=d_max-disp_min; d++)
+        mask[d>>6] |= (uint64_t)1<<(d&63);
     }
   }
   
-  // diffusion pointers
-  const int32_t* tl = temp1 + (0*grid_width+0)*(param.disp_max+1);
-  const int32_t* tc = temp1 + (0*grid_width+1)*(param.disp_max+1);
-  const int32_t* tr = temp1 + (0*grid_width+2)*(param.disp_max+1);
-  const int32_t* cl = temp1 + (1*grid_width+0)*(param.disp_max+1);
-  const int32_t* cc = temp1 + (1*grid_width+1)*(param.disp_max+1);
-  const int32_t* cr = temp1 + (1*grid_width+2)*(param.disp_max+1);
-  const int32_t* bl = temp1 + (2*grid_width+0)*(param.disp_max+1);
-  const int32_t* bc = temp1 + (2*grid_width+1)*(param.disp_max+1);
-  const int32_t* br = temp1 + (2*grid_width+2)*(param.disp_max+1);
-  
-  int32_t* result    = temp2 + (1*grid_width+1)*(param.disp_max+1); 
-  int32_t* end_input = temp1 + grid_width*grid_height*(param.disp_max+1);
-  
-  // diffuse temporary grid
-  for( ; br != end_input; tl++, tc++, tr++, cl++, cc++, cr++, bl++, bc++, br++, result++ )
-    *result = *tl | *tc | *tr | *cl | *cc | *cr | *bl | *bc | *br;
-  
-  // for all grid positions create disparity grid
-  for (int32_t x=0; x<grid_width; x++) {
-    for (int32_t y=0; y<grid_height; y++) {
-        
-      // start with second value (first is reserved for count)
-      int32_t curr_ind = 1;
-      
-      // for all disparities do
-      for (int32_t d=0; d<=param.disp_max; d++) {
-
-        // if yes => add this disparity to current cell
-        if (*(temp2+getAddressOffsetGrid(x,y,d,grid_width,param.disp_max+1))>0) {
-          *(disparity_grid+getAddressOffsetGrid(x,y,curr_ind,grid_width,param.disp_max+2))=d;
-          curr_ind++;
-        }
-      }
-      
-      // finally set number of indices
-      *(disparity_grid+getAddressOffsetGrid(x,y,0,grid_width,param.disp_max+2))=curr_ind-1;
+  // diffuse temporary grid: OR the 3x3 neighborhood (cell offsets as in
+  // the flat walk over the grid, i.e. wrapping around at the row ends)
+  const int32_t off[9] = {0,1,2,grid_width,grid_width+1,grid_width+2,
+                          2*grid_width,2*grid_width+1,2*grid_width+2};
+  for (int32_t c=0; c+2*grid_width+2<num_cells; c++) {
+    const uint64_t* in  = temp1+c*words;
+    uint64_t*       out = temp2+(c+grid_width+1)*words;
+#ifdef __AVX2__
+    for (int32_t k=0; k<words; k+=4) {
+      __m256i m = _mm256_loadu_si256((const __m256i*)(in+off[0]*words+k));
+      for (int32_t j=1; j<9; j++)
+        m = _mm256_or_si256(m,_mm256_loadu_si256((const __m256i*)(in+off[j]*words+k)));
+      _mm256_storeu_si256((__m256i*)(out+k),m);
     }
+#else
+    for (int32_t k=0; k<words; k+=2) {
+      __m128i m = _mm_loadu_si128((const __m128i*)(in+off[0]*words+k));
+      for (int32_t j=1; j<9; j++)
+        m = _mm_or_si128(m,_mm_loadu_si128((const __m128i*)(in+off[j]*words+k)));
+      _mm_storeu_si128((__m128i*)(out+k),m);
+    }
+#endif
   }
   
-  // release temporary memory
-  free(temp1);
-  free(temp2);
+  // start of each cell's candidate list (compressed row storage, so the
+  // grid scales with the number of candidates rather than the range)
+  grid_offset.resize(num_cells+1);
+  grid_offset[0] = 0;
+  for (int32_t c=0; c<num_cells; c++) {
+    const uint64_t* mask = temp2+c*words;
+    int32_t num = 0;
+    for (int32_t k=0; k<words; k++)
+      num += count_bits(mask[k]);
+    grid_offset[c+1] = grid_offset[c]+num;
+  }
+  grid_cand.resize(grid_offset[num_cells]);
+  
+  // for all grid positions add the set disparities in ascending order
+  for (int32_t c=0; c<num_cells; c++) {
+    const uint64_t* mask = temp2+c*words;
+    T*              cell = grid_cand.data()+grid_offset[c];
+    for (int32_t k=0; k<words; k++) {
+      for (uint64_t w=mask[k]; w; w&=w-1)
+        *(cell++) = 64*k+lowest_bit(w);
+    }
+  }
 }
 
 inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d,const int32_t &w,
@@ -938,27 +1311,83 @@ inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d
   }
 }
 
+#ifdef __AVX2__
+// SAD costs of the descriptor ymm1 (the same 16 bytes in both lanes) against
+// the descriptors at u_warp[0..7] of line, in candidate order
+static inline __m256i match_costs8 (const __m256i &ymm1,const uint8_t* line,const int32_t* u_warp) {
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  const __m512i zmm1 = _mm512_broadcast_i32x4(_mm256_castsi256_si128(ymm1));
+  __m512i z[2];
+  for (int32_t k=0; k<2; k++) {
+    z[k] = _mm512_castsi128_si512(_mm_load_si128((const __m128i*)(line+16*u_warp[4*k])));
+    z[k] = _mm512_inserti32x4(z[k],_mm_load_si128((const __m128i*)(line+16*u_warp[4*k+1])),1);
+    z[k] = _mm512_inserti32x4(z[k],_mm_load_si128((const __m128i*)(line+16*u_warp[4*k+2])),2);
+    z[k] = _mm512_inserti32x4(z[k],_mm_load_si128((const __m128i*)(line+16*u_warp[4*k+3])),3);
+    z[k] = _mm512_sad_epu8(zmm1,z[k]);
+    z[k] = _mm512_add_epi64(z[k],_mm512_bsrli_epi128(z[k],8));
+  }
+  // the costs are in the even 64-bit elements of z[0] and z[1]
+  const __m512i idx = _mm512_setr_epi64(0,2,4,6,8,10,12,14);
+  return _mm512_cvtepi64_epi32(_mm512_permutex2var_epi64(z[0],idx,z[1]));
+#else
+  __m256i c[4];
+  for (int32_t k=0; k<4; k++) {
+    __m256i y = _mm256_castsi128_si256(_mm_load_si128((const __m128i*)(line+16*u_warp[2*k])));
+    y = _mm256_inserti128_si256(y,_mm_load_si128((const __m128i*)(line+16*u_warp[2*k+1])),1);
+    y = _mm256_sad_epu8(ymm1,y);
+    c[k] = _mm256_add_epi32(y,_mm256_srli_si256(y,8));
+  }
+  // c[k] holds the costs of candidates 2k and 2k+1 in its elements 0 and 4
+  __m256i p0 = _mm256_blend_epi32(c[0],_mm256_slli_si256(c[1],4),0x22);
+  __m256i p1 = _mm256_blend_epi32(c[2],_mm256_slli_si256(c[3],4),0x22);
+  return _mm256_permutevar8x32_epi32(_mm256_unpacklo_epi64(p0,p1),_mm256_setr_epi32(0,4,1,5,2,6,3,7));
+#endif
+}
+
+// keep the per-lane minimum and the first candidate index attaining it
+static inline void update_lane_minimum (const __m256i &cost,const __m256i &idx,__m256i &min_cost,__m256i &min_idx) {
+  const __m256i lt = _mm256_cmpgt_epi32(min_cost,cost);
+  min_cost = _mm256_blendv_epi8(min_cost,cost,lt);
+  min_idx  = _mm256_blendv_epi8(min_idx,idx,lt);
+}
+
+// overall minimum of the lanes, ties go to the smallest candidate index
+static inline void reduce_lane_minimum (const __m256i &min_cost,const __m256i &min_idx,int32_t &val,int32_t &idx) {
+  int32_t c[8],k[8];
+  _mm256_storeu_si256((__m256i*)c,min_cost);
+  _mm256_storeu_si256((__m256i*)k,min_idx);
+  val = c[0]; idx = k[0];
+  for (int32_t j=1; j<8; j++) {
+    if (c[j]<val || (c[j]==val && k[j]<idx)) {
+      val = c[j];
+      idx = k[j];
+    }
+  }
+}
+#endif
+
+template <typename T,bool RIGHT,bool SUB,typename TD>
 inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,float &plane_c,
-                            int32_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
-                            int32_t *P,int32_t &plane_radius,bool &valid,bool &right_image,float* D){
+                            const T* grid_cand,const uint32_t* grid_offset,int32_t *grid_dims,
+                            uint8_t* I1_desc,uint8_t* I2_desc,
+                            const int32_t *P,int32_t &plane_radius,TD* D,int32_t* C){
   
   // get image width and height
-  const int32_t disp_num    = grid_dims[0]-1;
+  const int32_t disp_min    = max(param.disp_min,0);
   const int32_t window_size = 2;
 
   // address of disparity we want to compute
-  uint32_t d_addr;
-  if (param.subsampling) d_addr = getAddressOffsetImage(u/2,v/2,width/2);
-  else                   d_addr = getAddressOffsetImage(u,v,width);
+  const int32_t step = SUB ? subsamplingStep() : 1;
+  uint32_t d_addr = SUB ? getAddressOffsetImage(u/step,v/step,width/step) : getAddressOffsetImage(u,v,width);
   
   // check if u is ok
   if (u<window_size || u>=width-window_size)
     return;
 
-  // compute line start address
-  int32_t  line_offset = 16*width*max(min(v,height-3),2);
+  // compute line start address (descriptors hold every step-th row)
+  int32_t  line_offset = 16*width*(max(min(v,height-3),2)/step);
   uint8_t *I1_line_addr,*I2_line_addr;
-  if (!right_image) {
+  if (!RIGHT) {
     I1_line_addr = I1_desc+line_offset;
     I2_line_addr = I2_desc+line_offset;
   } else {
@@ -970,35 +1399,92 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
   uint8_t* I1_block_addr = I1_line_addr+16*u;
   
   // does this patch have enough texture?
-  int32_t sum = 0;
-  for (int32_t i=0; i<16; i++)
-    sum += abs((int32_t)(*(I1_block_addr+i))-128);
-  if (sum<param.match_texture)
+  if (patch_texture(I1_block_addr)<param.match_texture)
     return;
 
   // compute disparity, min disparity and max disparity of plane prior
   int32_t d_plane     = (int32_t)(plane_a*(float)u+plane_b*(float)v+plane_c);
-  int32_t d_plane_min = max(d_plane-plane_radius,0);
-  int32_t d_plane_max = min(d_plane+plane_radius,disp_num-1);
+  int32_t d_plane_min = max(d_plane-plane_radius,disp_min);
+  int32_t d_plane_max = min(d_plane+plane_radius,param.disp_max);
 
   // get grid pointer
   int32_t  grid_x    = (int32_t)floor((float)u/(float)param.grid_size);
   int32_t  grid_y    = (int32_t)floor((float)v/(float)param.grid_size);
-  uint32_t grid_addr = getAddressOffsetGrid(grid_x,grid_y,0,grid_dims[1],grid_dims[0]);  
-  int32_t  num_grid  = *(disparity_grid+grid_addr);
-  int32_t* d_grid    = disparity_grid+grid_addr+1;
+  uint32_t grid_cell = grid_y*grid_dims[1]+grid_x;
+  int32_t  num_grid  = grid_offset[grid_cell+1]-grid_offset[grid_cell];
+  const T* d_grid    = grid_cand+grid_offset[grid_cell];
   
   // loop variables
-  int32_t d_curr, u_warp, val;
   int32_t min_val = 10000;
   int32_t min_d   = -1;
   __m128i xmm1    = _mm_load_si128((__m128i*)I1_block_addr);
+
+#ifdef __AVX2__
+  // 8 candidates per iteration. The scalar code keeps the first minimum in
+  // visiting order (grid candidates outside the plane range, then the plane
+  // range), so each part keeps the first index per lane and the plane range
+  // only wins if it is strictly better.
+  const __m256i ymm1  = _mm256_broadcastsi128_si256(xmm1);
+  const __m256i lane  = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  const __m256i none  = _mm256_set1_epi32(min_val);
+  const __m256i u_vec = _mm256_set1_epi32(u);
+  const __m256i u_lo  = _mm256_set1_epi32(window_size-1);
+  const __m256i u_hi  = _mm256_set1_epi32(width-window_size);
+  const __m256i p_lo  = _mm256_set1_epi32(d_plane_min-1);
+  const __m256i p_hi  = _mm256_set1_epi32(d_plane_max+1);
+  int32_t d_buf[8],u_buf[8];
+
+  // grid candidates outside the plane range
+  __m256i min_cost = none, min_idx = _mm256_setzero_si256();
+  for (int32_t i=0; i<num_grid; i+=8) {
+    for (int32_t k=0; k<8; k++)
+      d_buf[k] = i+k<num_grid ? d_grid[i+k]+disp_min : 0;
+    __m256i d   = _mm256_loadu_si256((__m256i*)d_buf);
+    __m256i uw  = RIGHT ? _mm256_add_epi32(u_vec,d) : _mm256_sub_epi32(u_vec,d);
+    __m256i ok  = _mm256_and_si256(_mm256_cmpgt_epi32(uw,u_lo),_mm256_cmpgt_epi32(u_hi,uw));
+    ok = _mm256_and_si256(ok,_mm256_cmpgt_epi32(_mm256_set1_epi32(num_grid-i),lane));
+    ok = _mm256_andnot_si256(_mm256_and_si256(_mm256_cmpgt_epi32(d,p_lo),_mm256_cmpgt_epi32(p_hi,d)),ok);
+    _mm256_storeu_si256((__m256i*)u_buf,_mm256_blendv_epi8(u_vec,uw,ok));
+    __m256i cost = _mm256_blendv_epi8(none,match_costs8(ymm1,I2_line_addr,u_buf),ok);
+    update_lane_minimum(cost,_mm256_add_epi32(lane,_mm256_set1_epi32(i)),min_cost,min_idx);
+  }
+  int32_t grid_val,grid_idx;
+  reduce_lane_minimum(min_cost,min_idx,grid_val,grid_idx);
+  if (grid_val<min_val) {
+    min_val = grid_val;
+    min_d   = d_grid[grid_idx]+disp_min;
+  }
+
+  // plane range, weighted by the prior (P is defined for -plane_radius..
+  // plane_radius and padded for these loads, all zero if the plane is not
+  // valid)
+  min_cost = none; min_idx = _mm256_setzero_si256();
+  const int32_t num_plane = d_plane_max-d_plane_min+1;
+  for (int32_t i=0; i<num_plane; i+=8) {
+    __m256i d   = _mm256_add_epi32(lane,_mm256_set1_epi32(d_plane_min+i));
+    __m256i uw  = RIGHT ? _mm256_add_epi32(u_vec,d) : _mm256_sub_epi32(u_vec,d);
+    __m256i ok  = _mm256_and_si256(_mm256_cmpgt_epi32(uw,u_lo),_mm256_cmpgt_epi32(u_hi,uw));
+    ok = _mm256_and_si256(ok,_mm256_cmpgt_epi32(_mm256_set1_epi32(num_plane-i),lane));
+    _mm256_storeu_si256((__m256i*)u_buf,_mm256_blendv_epi8(u_vec,uw,ok));
+    __m256i cost = match_costs8(ymm1,I2_line_addr,u_buf);
+    cost = _mm256_add_epi32(cost,_mm256_loadu_si256((const __m256i*)(P+d_plane_min+i-d_plane)));
+    cost = _mm256_blendv_epi8(none,cost,ok);
+    update_lane_minimum(cost,_mm256_add_epi32(lane,_mm256_set1_epi32(i)),min_cost,min_idx);
+  }
+  int32_t plane_val,plane_idx;
+  reduce_lane_minimum(min_cost,min_idx,plane_val,plane_idx);
+  if (plane_val<min_val) {
+    min_val = plane_val;
+    min_d   = d_plane_min+plane_idx;
+  }
+#else
+  int32_t d_curr, u_warp, val;
   __m128i xmm2;
 
   // left image
-  if (!right_image) { 
+  if (!RIGHT) { 
     for (int32_t i=0; i<num_grid; i++) {
-      d_curr = d_grid[i];
+      d_curr = d_grid[i]+disp_min;
       if (d_curr<d_plane_min || d_curr>d_plane_max) {
         u_warp = u-d_curr;
         if (u_warp<window_size || u_warp>=width-window_size)
@@ -1010,13 +1496,13 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
       u_warp = u-d_curr;
       if (u_warp<window_size || u_warp>=width-window_size)
         continue;
-      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
+      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,*(P+abs(d_curr-d_plane)),xmm1,xmm2,val,min_val,min_d);
     }
     
   // right image
   } else {
     for (int32_t i=0; i<num_grid; i++) {
-      d_curr = d_grid[i];
+      d_curr = d_grid[i]+disp_min;
       if (d_curr<d_plane_min || d_curr>d_plane_max) {
         u_warp = u+d_curr;
         if (u_warp<window_size || u_warp>=width-window_size)
@@ -1028,79 +1514,120 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
       u_warp = u+d_curr;
       if (u_warp<window_size || u_warp>=width-window_size)
         continue;
-      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
+      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,*(P+abs(d_curr-d_plane)),xmm1,xmm2,val,min_val,min_d);
     }
   }
+#endif
 
   // set disparity value
-  if (min_d>=0) *(D+d_addr) = min_d; // MAP value (min neg-Log probability)
-  else          *(D+d_addr) = -1;    // invalid disparity
+  const int32_t scale = disparityScale(D);
+  if (min_d>=0) *(D+d_addr) = min_d*scale; // MAP value (min neg-Log probability)
+  else          *(D+d_addr) = -1*scale;    // invalid disparity
+  if (C) *(C+d_addr) = min_val;      // its cost
 }
 
-// TODO: %2 => more elegantly
-void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,int32_t* disparity_grid,int32_t *grid_dims,
-                            uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D) {
+// store 4 disparities (int16: rounded to 1/16 pixels)
+static inline void store_disparity4 (float* D,const __m128 &d) {
+  _mm_storeu_ps(D,d);
+}
 
-  // number of disparities
-  const int32_t disp_num  = grid_dims[0]-1;
-  
-  // descriptor window_size
-  int32_t window_size = 2;
-  
-  // init disparity image to -10
-  if (param.subsampling) {
-    for (int32_t i=0; i<(width/2)*(height/2); i++)
-      *(D+i) = -10;
-  } else {
-    for (int32_t i=0; i<width*height; i++)
-      *(D+i) = -10;
+static inline void store_disparity4 (int16_t* D,const __m128 &d) {
+  __m128i d16 = _mm_cvtps_epi32(_mm_mul_ps(d,_mm_set1_ps(16)));
+  _mm_storel_epi64((__m128i*)D,_mm_packs_epi32(d16,d16));
+}
+
+static inline void store_disparity (float* D,float d) {
+  *D = d;
+}
+
+static inline void store_disparity (int16_t* D,float d) {
+  *D = _mm_cvtss_si32(_mm_set_ss(d*16));
+}
+
+template <bool SUB,typename TD>
+inline void Elas::fillPlane(int32_t u_begin,int32_t u_end,int32_t v,float plane_a,float plane_b,float plane_c,
+                            TD* D,int32_t* C) {
+
+  // same columns as findMatch, clamped to the disparity range
+  const int32_t window_size = 2;
+  const int32_t step        = SUB ? subsamplingStep() : 1;
+  u_begin = max(u_begin,window_size);
+  if (SUB) u_begin += (step-u_begin%step)%step;
+  u_end = min(u_end,width-window_size);
+  if (u_begin>=u_end)
+    return;
+  const float d_min = max(param.disp_min,0);
+  const float d_max = param.disp_max;
+  const float d_row = plane_b*(float)v+plane_c;
+
+  // disparity image indices of the columns u_begin,u_begin+step,..<u_end
+  TD*     D_line = SUB ? D+(v/step)*(width/step) : D+v*width;
+  int32_t i      = u_begin/step;
+  int32_t i_end  = (u_end+step-1)/step;
+  if (C) {
+    int32_t* C_line = SUB ? C+(v/step)*(width/step) : C+v*width;
+    for (int32_t j=i; j<i_end; j++)
+      C_line[j] = 0;
   }
-  
-  // pre-compute prior 
-  float two_sigma_squared = 2*param.sigma*param.sigma;
-  int32_t* P = new int32_t[disp_num];
-  for (int32_t delta_d=0; delta_d<disp_num; delta_d++)
-    P[delta_d] = (int32_t)((-log(param.gamma+exp(-delta_d*delta_d/two_sigma_squared))+log(param.gamma))/param.beta);
-  int32_t plane_radius = (int32_t)max((float)ceil(param.sigma*param.sradius),(float)2.0);
+
+  // 4 disparities per iteration
+  const __m128 xmm_a    = _mm_set1_ps(plane_a);
+  const __m128 xmm_row  = _mm_set1_ps(d_row);
+  const __m128 xmm_min  = _mm_set1_ps(d_min);
+  const __m128 xmm_max  = _mm_set1_ps(d_max);
+  const __m128 xmm_lane = _mm_setr_ps(0,step,2*step,3*step);
+  for (; i+4<=i_end; i+=4) {
+    __m128 u = _mm_add_ps(_mm_set1_ps((float)(i*step)),xmm_lane);
+    __m128 d = _mm_add_ps(_mm_mul_ps(xmm_a,u),xmm_row);
+    store_disparity4(D_line+i,_mm_min_ps(_mm_max_ps(d,xmm_min),xmm_max));
+  }
+  for (; i<i_end; i++)
+    store_disparity(D_line+i,min(max(plane_a*(float)(i*step)+d_row,d_min),d_max));
+}
+
+template <typename T,bool RIGHT,bool SUB,typename TD>
+void Elas::matchTriangles(const triangle_table &tab,
+                          const T* grid_cand,const uint32_t* grid_offset,int32_t *grid_dims,
+                          uint8_t* I1_desc,uint8_t* I2_desc,const int32_t *P,const int32_t *P_zero,
+                          int32_t plane_radius,TD* D,int32_t* C) {
 
   // loop variables
-  int32_t c1, c2, c3;
   float plane_a,plane_b,plane_c,plane_d;
   
+  // vertical pixel span of each image column within the current triangle
+  span_lo_.resize(width);
+  span_hi_.resize(width);
+  int32_t *span_lo = span_lo_.data(), *span_hi = span_hi_.data();
+  
   // for all triangles do
-  for (uint32_t i=0; i<tri.size(); i++) {
+  const int32_t num_tri = tab.size();
+  for (int32_t i=0; i<num_tri; i++) {
     
     // get plane parameters
-    uint32_t p_i = i*3;
-    if (!right_image) {
-      plane_a = tri[i].t1a;
-      plane_b = tri[i].t1b;
-      plane_c = tri[i].t1c;
-      plane_d = tri[i].t2a;
+    if (!RIGHT) {
+      plane_a = tab.t1a[i];
+      plane_b = tab.t1b[i];
+      plane_c = tab.t1c[i];
+      plane_d = tab.t2a[i];
     } else {
-      plane_a = tri[i].t2a;
-      plane_b = tri[i].t2b;
-      plane_c = tri[i].t2c;
-      plane_d = tri[i].t1a;
+      plane_a = tab.t2a[i];
+      plane_b = tab.t2b[i];
+      plane_c = tab.t2c[i];
+      plane_d = tab.t1a[i];
     }
     
-    // triangle corners
-    c1 = tri[i].c1;
-    c2 = tri[i].c2;
-    c3 = tri[i].c3;
-
     // sort triangle corners wrt. u (ascending)    
     float tri_u[3];
-    if (!right_image) {
-      tri_u[0] = p_support[c1].u;
-      tri_u[1] = p_support[c2].u;
-      tri_u[2] = p_support[c3].u;
+    if (!RIGHT) {
+      tri_u[0] = tab.u1[i];
+      tri_u[1] = tab.u2[i];
+      tri_u[2] = tab.u3[i];
     } else {
-      tri_u[0] = p_support[c1].u-p_support[c1].d;
-      tri_u[1] = p_support[c2].u-p_support[c2].d;
-      tri_u[2] = p_support[c3].u-p_support[c3].d;
+      tri_u[0] = tab.u1[i]-tab.d1[i];
+      tri_u[1] = tab.u2[i]-tab.d2[i];
+      tri_u[2] = tab.u3[i]-tab.d3[i];
     }
-    float tri_v[3] = {p_support[c1].v,p_support[c2].v,p_support[c3].v};
+    float tri_v[3] = {(float)tab.v1[i],(float)tab.v2[i],(float)tab.v3[i]};
     
     for (uint32_t j=0; j<3; j++) {
       for (uint32_t k=0; k<j; k++) {
@@ -1128,288 +1655,649 @@ void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,in
     // a plane is only valid if itself and its projection
     // into the other image is not too much slanted
     bool valid = fabs(plane_a)<0.7 && fabs(plane_d)<0.7;
+    bool fill  = valid && tab.planar[i];
+    const int32_t *W = valid ? P : P_zero;
         
-    // first part (triangle corner A->B)
-    if ((int32_t)(A_u)!=(int32_t)(B_u)) {
-      for (int32_t u=max((int32_t)A_u,0); u<min((int32_t)B_u,width); u++){
-        if (!param.subsampling || u%2==0) {
-          int32_t v_1 = (uint32_t)(AC_a*(float)u+AC_b);
-          int32_t v_2 = (uint32_t)(AB_a*(float)u+AB_b);
-          for (int32_t v=min(v_1,v_2); v<max(v_1,v_2); v++)
-            if (!param.subsampling || v%2==0) {
-              findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
-                        I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
-            }
+    // vertical span [span_lo,span_hi) of each column, first part (triangle
+    // corner A->B) and second part (triangle corner B->C), subsampling only
+    // visits every step-th column and row
+    const int32_t step = SUB ? subsamplingStep() : 1;
+    int32_t u_first = width, u_last = 0;
+    int32_t v_first = 0,     v_last = 0;
+    for (int32_t part=0; part<2; part++) {
+      float U0 = part ? B_u : A_u;
+      float U1 = part ? C_u : B_u;
+      float line_a = part ? BC_a : AB_a;
+      float line_b = part ? BC_b : AB_b;
+      if ((int32_t)(U0)==(int32_t)(U1))
+        continue;
+      int32_t u_start = max((int32_t)U0,0);
+      if (SUB) u_start += (step-u_start%step)%step;
+      for (int32_t u=u_start; u<min((int32_t)U1,width); u+=step){
+        int32_t v_1 = (uint32_t)(AC_a*(float)u+AC_b);
+        int32_t v_2 = (uint32_t)(line_a*(float)u+line_b);
+        span_lo[u] = min(v_1,v_2);
+        span_hi[u] = max(v_1,v_2);
+        if (span_lo[u]<span_hi[u]) {
+          v_first = u_first<u_last ? min(v_first,span_lo[u]) : span_lo[u];
+          v_last  = u_first<u_last ? max(v_last,span_hi[u])  : span_hi[u];
+          u_first = min(u_first,u);
+          u_last  = max(u_last,u+1);
         }
       }
     }
-
-    // second part (triangle corner B->C)
-    if ((int32_t)(B_u)!=(int32_t)(C_u)) {
-      for (int32_t u=max((int32_t)B_u,0); u<min((int32_t)C_u,width); u++){
-        if (!param.subsampling || u%2==0) {
-          int32_t v_1 = (uint32_t)(AC_a*(float)u+AC_b);
-          int32_t v_2 = (uint32_t)(BC_a*(float)u+BC_b);
-          for (int32_t v=min(v_1,v_2); v<max(v_1,v_2); v++)
-            if (!param.subsampling || v%2==0) {
-              findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
-                        I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
-            }
+    
+    // visit the pixels row by row, so that descriptors and disparities are
+    // accessed in memory order
+    if (SUB) v_first += (step-v_first%step)%step;
+    v_last = min(v_last,height/step*step);
+
+    // planar triangle: interpolate each run of covered pixels
+    if (fill) {
+      for (int32_t v=v_first; v<v_last; v+=step) {
+        int32_t u = u_first;
+        while (u<u_last) {
+          while (u<u_last && (v<span_lo[u] || v>=span_hi[u])) u+=step;
+          int32_t u_begin = u;
+          while (u<u_last && v>=span_lo[u] && v<span_hi[u]) u+=step;
+          if (u_begin<u)
+            fillPlane<SUB>(u_begin,u,v,plane_a,plane_b,plane_c,D,C);
         }
       }
+      continue;
     }
-    
+
+    for (int32_t v=v_first; v<v_last; v+=step) {
+      for (int32_t u=u_first; u<u_last; u+=step) {
+        if (v>=span_lo[u] && v<span_hi[u])
+          findMatch<T,RIGHT,SUB>(u,v,plane_a,plane_b,plane_c,grid_cand,grid_offset,grid_dims,
+                                 I1_desc,I2_desc,W,plane_radius,D,C);
+      }
+    }
+  }
+
+}
+
+template <typename T,typename TD>
+void Elas::computeDisparity(const triangle_table &tab,
+                            const T* grid_cand,const uint32_t* grid_offset,int32_t *grid_dims,
+                            uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,TD* D,int32_t* C) {
+
+  // init disparity image to -10
+  const int32_t step = subsamplingStep();
+  for (int32_t i=0; i<(width/step)*(height/step); i++)
+    *(D+i) = -10*disparityScale(D);
+  
+  // pre-compute prior (only used within the plane radius), P[delta_d] is
+  // defined for -plane_radius..plane_radius and zero padded for SIMD loads
+  float two_sigma_squared = 2*param.sigma*param.sigma;
+  int32_t plane_radius = (int32_t)max((float)ceil(param.sigma*param.sradius),(float)2.0);
+  prior_.resize(2*plane_radius+1+8);
+  int32_t* P = prior_.data()+plane_radius;
+  for (int32_t delta_d=-plane_radius; delta_d<=plane_radius+8; delta_d++)
+    P[delta_d] = abs(delta_d)>plane_radius ? 0 :
+      (int32_t)((-log(param.gamma+exp(-delta_d*delta_d/two_sigma_squared))+log(param.gamma))/param.beta);
+
+  prior_zero_.assign(2*plane_radius+1+8,0);
+  int32_t* P_zero = prior_zero_.data()+plane_radius;
+
+  // select the specialized kernel once per image
+  if (!right_image) {
+    if (step>1) matchTriangles<T,false,true> (tab,grid_cand,grid_offset,grid_dims,I1_desc,I2_desc,P,P_zero,plane_radius,D,C);
+    else        matchTriangles<T,false,false>(tab,grid_cand,grid_offset,grid_dims,I1_desc,I2_desc,P,P_zero,plane_radius,D,C);
+  } else {
+    if (step>1) matchTriangles<T,true,true>  (tab,grid_cand,grid_offset,grid_dims,I1_desc,I2_desc,P,P_zero,plane_radius,D,C);
+    else        matchTriangles<T,true,false> (tab,grid_cand,grid_offset,grid_dims,I1_desc,I2_desc,P,P_zero,plane_radius,D,C);
   }
 
-  delete[] P;
 }
 
-void Elas::leftRightConsistencyCheck(float* D1,float* D2) {
+// copy a disparity row into a float buffer
+static inline void load_disparity_row (const float* D,float* row,int32_t n) {
+  memcpy(row,D,n*sizeof(float));
+}
+
+static inline void load_disparity_row (const int16_t* D,float* row,int32_t n) {
+  for (int32_t u=0; u<n; u++)
+    row[u] = D[u];
+}
+
+// L/R check of one row: pixel u of D (copied to row) is invalidated
+// unless it warps into [0,n) to u_warp = u+sign*d/k and
+// |row_other[u_warp]-d| <= lr_threshold, 4 pixels per iteration
+template <typename TD>
+static inline void lr_check_row (const float* row,const float* row_other,TD* D,int32_t n,
+                                 float sign,float k,float lr_threshold,TD invalid) {
+  const __m128 xsign = _mm_set1_ps(sign);
+  const __m128 xk    = _mm_set1_ps(k);
+  const __m128 xthr  = _mm_set1_ps(lr_threshold);
+  const __m128 xn    = _mm_set1_ps((float)n);
+  const __m128 xzero = _mm_setzero_ps();
+  const __m128 xabs  = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  int32_t idx[4];
+  float   d_warp[4];
+  int32_t u = 0;
+  for (; u+4<=n; u+=4) {
+    __m128 d      = _mm_loadu_ps(row+u);
+    __m128 u_warp = _mm_add_ps(_mm_add_ps(_mm_set1_ps((float)u),_mm_setr_ps(0,1,2,3)),
+                               _mm_mul_ps(xsign,_mm_div_ps(d,xk)));
+    __m128 ok     = _mm_and_ps(_mm_cmpge_ps(d,xzero),
+                               _mm_and_ps(_mm_cmpge_ps(u_warp,xzero),_mm_cmplt_ps(u_warp,xn)));
+    _mm_storeu_si128((__m128i*)idx,_mm_and_si128(_mm_cvttps_epi32(u_warp),_mm_castps_si128(ok)));
+    for (int32_t j=0; j<4; j++)
+      d_warp[j] = row_other[idx[j]];
+    __m128 diff = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(d_warp),d),xabs);
+    ok = _mm_and_ps(ok,_mm_cmple_ps(diff,xthr));
+    int32_t fail = ~_mm_movemask_ps(ok) & 15;
+    for (int32_t j=0; fail; j++, fail>>=1)
+      if (fail&1) D[u+j] = invalid;
+  }
+  for (; u<n; u++) {
+    float d      = row[u];
+    float u_warp = (float)u+sign*(d/k);
+    if (!(d>=0 && u_warp>=0 && u_warp<n) || fabs(row_other[(int32_t)u_warp]-d)>lr_threshold)
+      D[u] = invalid;
+  }
+}
+
+template <typename TD>
+void Elas::leftRightConsistencyCheck(TD* D1,TD* D2) {
   
   // get disparity image dimensions
-  int32_t D_width  = width;
-  int32_t D_height = height;
-  if (param.subsampling) {
-    D_width  = width/2;
-    D_height = height/2;
+  const int32_t step = subsamplingStep();
+  int32_t D_width  = width/step;
+  int32_t D_height = height/step;
+  
+  // disparity units per pixel and per output column
+  const int32_t scale   = disparityScale(D1);
+  const TD      invalid = -10*scale;
+  const float   lr_threshold = param.lr_threshold*scale;
+  const float   k = step*scale;
+
+  // rows are independent, each one is checked in place from a copy of
+  // the left and right row (one pair of row buffers per thread)
+#ifdef _OPENMP
+  lr_rows_.resize(omp_get_max_threads()*2*D_width);
+#pragma omp parallel
+#else
+  lr_rows_.resize(2*D_width);
+#endif
+  {
+#ifdef _OPENMP
+    float* row1 = lr_rows_.data()+omp_get_thread_num()*2*D_width;
+#else
+    float* row1 = lr_rows_.data();
+#endif
+    float* row2 = row1+D_width;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for (int32_t v=0; v<D_height; v++) {
+      TD* D1_line = D1+v*D_width;
+      TD* D2_line = D2+v*D_width;
+      load_disparity_row(D1_line,row1,D_width);
+      load_disparity_row(D2_line,row2,D_width);
+      lr_check_row(row1,row2,D1_line,D_width,-1,k,lr_threshold,invalid);
+      lr_check_row(row2,row1,D2_line,D_width,+1,k,lr_threshold,invalid);
+    }
   }
+}
+
+template <typename TD>
+void Elas::rightFromLeftDisparity(const TD* D1,const int32_t* C1,TD* D2) {
+  
+  // get disparity image dimensions
+  const int32_t step = subsamplingStep();
+  int32_t D_width  = width/step;
+  int32_t D_height = height/step;
   
-  // make a copy of both images
-  float* D1_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  float* D2_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  memcpy(D1_copy,D1,D_width*D_height*sizeof(float));
-  memcpy(D2_copy,D2,D_width*D_height*sizeof(float));
+  // disparity units per output column
+  const int32_t scale = disparityScale(D1)*step;
 
-  // loop variables
-  uint32_t addr,addr_warp;
-  float    u_warp_1,u_warp_2,d1,d2;
+  // best and second best cost of the left pixels claiming each right pixel
+  right_cost_.resize(2*D_width);
+  int32_t* C2   = right_cost_.data();
+  int32_t* C2_2 = C2+D_width;
   
-  // for all image points do
-  for (int32_t u=0; u<D_width; u++) {
-    for (int32_t v=0; v<D_height; v++) {
-      
-      // compute address (u,v) and disparity value
-      addr     = getAddressOffsetImage(u,v,D_width);
-      d1       = *(D1_copy+addr);
-      d2       = *(D2_copy+addr);
-      if (param.subsampling) {
-        u_warp_1 = (float)u-d1/2;
-        u_warp_2 = (float)u+d2/2;
-      } else {
-        u_warp_1 = (float)u-d1;
-        u_warp_2 = (float)u+d2;
+  // for all image rows do
+  for (int32_t v=0; v<D_height; v++) {
+    
+    const TD*      D1_line = D1+v*D_width;
+    const int32_t* C1_line = C1+v*D_width;
+    TD*            D2_line = D2+v*D_width;
+    for (int32_t u=0; u<D_width; u++) {
+      D2_line[u] = -10*disparityScale(D2);
+      C2[u]      = 10000; // above any cost accepted by findMatch
+      C2_2[u]    = 10000;
+    }
+    
+    // every matched left pixel votes for the right pixel it was matched
+    // to (warped as in the L/R check), the vote with the lowest cost wins
+    // and ties go to the larger (closer) disparity
+    for (int32_t u=0; u<D_width; u++) {
+      TD d1 = D1_line[u];
+      if (d1<0)
+        continue;
+      float u_warp = scale>1 ? (float)u-(float)d1/scale : (float)u-d1;
+      if (u_warp<0 || u_warp>=D_width)
+        continue;
+      int32_t u2 = (int32_t)u_warp;
+      int32_t c1 = C1_line[u];
+      if (c1<C2[u2] || (c1==C2[u2] && d1>D2_line[u2])) {
+        C2_2[u2]    = C2[u2];
+        C2[u2]      = c1;
+        D2_line[u2] = d1;
+      } else if (c1<C2_2[u2]) {
+        C2_2[u2]    = c1;
       }
+    }
+    
+    // uniqueness ratio test as in the support matching: right pixels
+    // claimed by several left pixels must have a clearly best one
+    for (int32_t u=0; u<D_width; u++)
+      if (C2_2[u]<10000 && (float)C2[u]>=param.support_threshold*(float)C2_2[u])
+        D2_line[u] = -10*disparityScale(D2);
+  }
+}
+
+// union-find over segment runs (path halving)
+static inline int32_t find_run_root (int32_t* parent,int32_t r) {
+  while (parent[r]!=r) {
+    parent[r] = parent[parent[r]];
+    r = parent[r];
+  }
+  return r;
+}
+
+static inline void unite_runs (int32_t* parent,int32_t a,int32_t b) {
+  a = find_run_root(parent,a);
+  b = find_run_root(parent,b);
+  if (a<b)      parent[b] = a;
+  else if (b<a) parent[a] = b;
+}
+
+// splits a row into runs of valid pixels whose horizontal neighbours are
+// similar, stores [u0,u1) of each run (if u0/u1 are given) and returns
+// the number of runs
+template <typename TD>
+static int32_t extract_runs (const TD* D_line,int32_t D_width,float threshold,
+                             int32_t* u0,int32_t* u1) {
+  int32_t n = 0;
+  for (int32_t u=0; u<D_width; ) {
+    if (D_line[u]<0) {
+      u++;
+      continue;
+    }
+    int32_t u_start = u++;
+    while (u<D_width && D_line[u]>=0 && fabs((float)D_line[u-1]-D_line[u])<=threshold)
+      u++;
+    if (u0) {
+      u0[n] = u_start;
+      u1[n] = u;
+    }
+    n++;
+  }
+  return n;
+}
+
+// unites the runs [i,i_end) of a row with the runs [j,j_end) of the row
+// below wherever two vertically adjacent pixels are similar
+template <typename TD>
+static void unite_rows (const TD* D_top,const TD* D_bottom,int32_t i,int32_t i_end,int32_t j,int32_t j_end,
+                        const int32_t* u0,const int32_t* u1,float threshold,int32_t* parent) {
+  while (i<i_end && j<j_end) {
+    int32_t u_end = min(u1[i],u1[j]);
+    for (int32_t u=max(u0[i],u0[j]); u<u_end; u++) {
+      if (fabs((float)D_top[u]-D_bottom[u])<=threshold) {
+        unite_runs(parent,i,j);
+        break;
+      }
+    }
+    if (u1[i]<u1[j]) i++;
+    else             j++;
+  }
+}
+
+// index of the run covering pixel u of a row, -1 if there is none
+static int32_t run_at (const int32_t* u0,const int32_t* u1,int32_t first,int32_t last,int32_t u) {
+  int32_t r = upper_bound(u0+first,u0+last,u)-u0-1;
+  return (r>=first && u<u1[r]) ? r : -1;
+}
+
+template <typename TD>
+void Elas::postProcess (TD* D) {
+  
+  const int32_t step     = subsamplingStep();
+  const int32_t D_width  = width/step;
+  const int32_t D_height = height/step;
+  const int32_t taps     = step>1 ? 4 : 8;
+  
+  // workspaces of the stages, kept across calls
+  gap_count_.assign(D_width,0);
+  if (param.filter_adaptive_mean) {
+    meanCopyBuffer(D).resize(D_width*D_height);
+    meanTmpBuffer(D).resize(D_width*D_height);
+  }
+  if (param.filter_median)
+    medianBuffer(D).resize(D_width*D_height);
+  
+  // speckle segments span the whole image and are labelled first
+#ifdef PROFILE
+  timer.start("Label Small Segments");
+#endif
+  labelSmallSegments(D);
+  
+  // all other stages run over stripes of rows while these are in cache.
+  // A stage processes the rows on which the stages before are final:
+  // later gaps reach back ipolGapWidth() rows and read one row above,
+  // the vertical filters need taps/2-1 and 3 rows below their output.
+  // One parallel region covers all stripes, the stages share its threads
+  // by omp for loops (each ending in a barrier). The stages interleave,
+  // so they are profiled as one.
+  const int32_t stripe_height = 16;
+#ifdef PROFILE
+  timer.start("Postprocessing");
+#endif
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    int32_t v_mean = 0,v_mean_out = 0,v_median = 0,v_median_out = 0;
+    for (int32_t v=0; v<D_height; ) {
       
+      int32_t v_end = min(v+stripe_height,D_height);
+      removeSmallSegments(D,v,v_end);
+      gapInterpolationRows(D,v,v_end);
+      gapInterpolationColumns(D,v,v_end);
+      v = v_end;
       
-      // check if left disparity is valid
-      if (d1>=0 && u_warp_1>=0 && u_warp_1<D_width) {       
-                  
-        // compute warped image address
-        addr_warp = getAddressOffsetImage((int32_t)u_warp_1,v,D_width);
-
-        // if check failed
-        if (fabs(*(D2_copy+addr_warp)-d1)>param.lr_threshold)
-          *(D1+addr) = -10;
-        
-      // set invalid
-      } else
-        *(D1+addr) = -10;
+      bool    last    = v==D_height;
+      int32_t v_final = last ? D_height : max(v-max(ipolGapWidth(),0)-1,0);
+      
+      if (param.filter_adaptive_mean) {
+        adaptiveMeanRows(D,v_mean,v_final);
+        v_mean  = v_final;
+        v_final = last ? D_height : max(v_final-(taps/2-1),0);
+        adaptiveMeanColumns(D,v_mean_out,v_final);
+        v_mean_out = v_final;
+      }
       
-      // check if right disparity is valid
-      if (d2>=0 && u_warp_2>=0 && u_warp_2<D_width) {       
+      if (param.filter_median) {
+        medianRows(D,v_median,v_final);
+        v_median = v_final;
+        v_final  = last ? D_height : max(v_final-3,0);
+        medianColumns(D,v_median_out,v_final);
+        v_median_out = v_final;
+      }
+    }
+  }
+}
 
-        // compute warped image address
-        addr_warp = getAddressOffsetImage((int32_t)u_warp_2,v,D_width);
+int32_t Elas::speckleSize () const {
+  const int32_t step = subsamplingStep();
+  if (step>1) // scales the area of the factor 2 setting
+    return sqrt((float)param.speckle_size)*8/(step*step);
+  return param.speckle_size;
+}
 
-        // if check failed
-        if (fabs(*(D1_copy+addr_warp)-d2)>param.lr_threshold)
-          *(D2+addr) = -10;
-        
-      // set invalid
-      } else
-        *(D2+addr) = -10;
+template <typename TD>
+void Elas::labelSmallSegments (TD* D) {
+  
+  // get disparity image dimensions
+  const int32_t step     = subsamplingStep();
+  int32_t D_width        = width/step;
+  int32_t D_height       = height/step;
+  int32_t D_speckle_size = speckleSize();
+  const float speckle_sim_threshold = param.speckle_sim_threshold*disparityScale(D);
+  
+  // segments are the 4-connected components of valid pixels with similar
+  // neighbours. Each row is split into runs of such pixels, the runs are
+  // joined by union-find and every segment below the speckle size is
+  // marked for removeSmallSegments(). This replaces a pixel-wise flood
+  // fill in column-major order and produces exactly its result.
+  
+  // count the runs of each row, then store them at the row offsets
+  vector<int32_t> &row_first = speckle_row_first_;
+  row_first.assign(D_height+1,0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int32_t v=0; v<D_height; v++)
+    row_first[v+1] = extract_runs(D+v*D_width,D_width,speckle_sim_threshold,0,0);
+  for (int32_t v=0; v<D_height; v++)
+    row_first[v+1] += row_first[v];
+  const int32_t num_runs = row_first[D_height];
+  
+  speckle_u0_.resize(num_runs);
+  speckle_u1_.resize(num_runs);
+  speckle_parent_.resize(num_runs);
+  int32_t* u0     = speckle_u0_.data();
+  int32_t* u1     = speckle_u1_.data();
+  int32_t* parent = speckle_parent_.data();
+  
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int32_t v=0; v<D_height; v++) {
+    extract_runs(D+v*D_width,D_width,speckle_sim_threshold,u0+row_first[v],u1+row_first[v]);
+    for (int32_t r=row_first[v]; r<row_first[v+1]; r++)
+      parent[r] = r;
+  }
+  
+  // join the runs of adjacent rows: stripes of rows touch only their own
+  // runs and are handled in parallel, the stripe borders afterwards
+  const int32_t stripe_height = 32;
+  const int32_t num_stripes   = (D_height+stripe_height-1)/stripe_height;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int32_t s=0; s<num_stripes; s++) {
+    int32_t v_end = min((s+1)*stripe_height,D_height);
+    for (int32_t v=s*stripe_height; v+1<v_end; v++)
+      unite_rows(D+v*D_width,D+(v+1)*D_width,row_first[v],row_first[v+1],row_first[v+1],row_first[v+2],
+                 u0,u1,speckle_sim_threshold,parent);
+  }
+  for (int32_t s=1; s<num_stripes; s++) {
+    int32_t v = s*stripe_height-1;
+    unite_rows(D+v*D_width,D+(v+1)*D_width,row_first[v],row_first[v+1],row_first[v+1],row_first[v+2],
+               u0,u1,speckle_sim_threshold,parent);
+  }
+  
+  // size of each segment and the position (u*D_height+v) at which the
+  // column-major flood fill reaches it first
+  speckle_count_.assign(num_runs,0);
+  speckle_first_.assign(num_runs,D_width*D_height);
+  int32_t* count = speckle_count_.data();
+  int32_t* first = speckle_first_.data();
+  for (int32_t v=0; v<D_height; v++) {
+    for (int32_t r=row_first[v]; r<row_first[v+1]; r++) {
+      int32_t root = parent[r] = find_run_root(parent,r);
+      count[root] += u1[r]-u0[r];
+      first[root]  = min(first[root],u0[r]*D_height+v);
     }
   }
   
-  // release memory
-  free(D1_copy);
-  free(D2_copy);
+  // the flood fill also starts segments at invalid pixels, which have a
+  // size of 1, but such a seed takes over every not yet visited segment
+  // next to it that is within the similarity threshold (only possible for
+  // thresholds above the gap between invalid and valid disparities)
+  vector<pair<int32_t,int32_t> > &seeds = speckle_seeds_;
+  seeds.clear();
+  for (int32_t v=0; v<D_height; v++) {
+    const TD* D_line = D+v*D_width;
+    for (int32_t u=0; u<D_width; u++) {
+      TD d = D_line[u];
+      if (d>=0 || d+speckle_sim_threshold<0)
+        continue;
+      for (int32_t i=0; i<4; i++) {
+        int32_t un = u+(i==0 ? -1 : i==1 ? 1 : 0);
+        int32_t vn = v+(i==2 ? -1 : i==3 ? 1 : 0);
+        if (un<0 || vn<0 || un>=D_width || vn>=D_height || D[vn*D_width+un]<0 ||
+            fabs((float)d-D[vn*D_width+un])>speckle_sim_threshold)
+          continue;
+        int32_t r = run_at(u0,u1,row_first[vn],row_first[vn+1],un);
+        seeds.push_back(make_pair(u*D_height+v,parent[r]));
+      }
+    }
+  }
+  for (size_t i=0; i<seeds.size(); i++)
+    first[seeds[i].second] = min(first[seeds[i].second],seeds[i].first);
+  
+  // segments to remove; surviving invalid seeds keep their values
+  speckle_remove_.resize(num_runs);
+  uint8_t* remove = speckle_remove_.data();
+  for (int32_t r=0; r<num_runs; r++)
+    if (parent[r]==r)
+      remove[r] = count[r]<D_speckle_size;
+  sort(seeds.begin(),seeds.end());
+  seeds.erase(unique(seeds.begin(),seeds.end()),seeds.end());
+  vector<pair<int32_t,float> > &kept = speckle_kept_;
+  kept.clear();
+  for (size_t i=0; i<seeds.size(); ) {
+    size_t  i_end = i;
+    int32_t size  = 1;
+    for (; i_end<seeds.size() && seeds[i_end].first==seeds[i].first; i_end++)
+      if (first[seeds[i_end].second]==seeds[i].first)
+        size += count[seeds[i_end].second];
+    for (size_t k=i; k<i_end; k++)
+      if (first[seeds[k].second]==seeds[i].first)
+        remove[seeds[k].second] = size<D_speckle_size;
+    if (size>=D_speckle_size) {
+      int32_t addr = getAddressOffsetImage(seeds[i].first/D_height,seeds[i].first%D_height,D_width);
+      kept.push_back(make_pair(addr,D[addr]));
+    }
+    i = i_end;
+  }
+  sort(kept.begin(),kept.end());
 }
 
-void Elas::removeSmallSegments (float* D) {
-  
-  // get disparity image dimensions
-  int32_t D_width        = width;
-  int32_t D_height       = height;
-  int32_t D_speckle_size = param.speckle_size;
-  if (param.subsampling) {
-    D_width        = width/2;
-    D_height       = height/2;
-    D_speckle_size = sqrt((float)param.speckle_size)*2;
-  }
-  
-  // allocate memory on heap for dynamic programming arrays
-  int32_t *D_done     = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t *seg_list_u = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t *seg_list_v = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t seg_list_count;
-  int32_t seg_list_curr;
-  int32_t u_neighbor[4];
-  int32_t v_neighbor[4];
-  int32_t u_seg_curr;
-  int32_t v_seg_curr;
-  
-  // declare loop variables
-  int32_t addr_start, addr_curr, addr_neighbor;
-  
-  // for all pixels do
-  for (int32_t u=0; u<D_width; u++) {
-    for (int32_t v=0; v<D_height; v++) {
-      
-      // get address of first pixel in this segment
-      addr_start = getAddressOffsetImage(u,v,D_width);
-                  
-      // if this pixel has not already been processed
-      if (*(D_done+addr_start)==0) {
-                
-        // init segment list (add first element
-        // and set it to be the next element to check)
-        *(seg_list_u+0) = u;
-        *(seg_list_v+0) = v;
-        seg_list_count  = 1;
-        seg_list_curr   = 0;
-        
-        // add neighboring segments as long as there
-        // are none-processed pixels in the seg_list;
-        // none-processed means: seg_list_curr<seg_list_count
-        while (seg_list_curr<seg_list_count) {
-        
-          // get current position from seg_list
-          u_seg_curr = *(seg_list_u+seg_list_curr);
-          v_seg_curr = *(seg_list_v+seg_list_curr);
-          
-          // get address of current pixel in this segment
-          addr_curr = getAddressOffsetImage(u_seg_curr,v_seg_curr,D_width);
-          
-          // fill list with neighbor positions
-          u_neighbor[0] = u_seg_curr-1; v_neighbor[0] = v_seg_curr;
-          u_neighbor[1] = u_seg_curr+1; v_neighbor[1] = v_seg_curr;
-          u_neighbor[2] = u_seg_curr;   v_neighbor[2] = v_seg_curr-1;
-          u_neighbor[3] = u_seg_curr;   v_neighbor[3] = v_seg_curr+1;
-          
-          // for all neighbors do
-          for (int32_t i=0; i<4; i++) {
-            
-            // check if neighbor is inside image
-            if (u_neighbor[i]>=0 && v_neighbor[i]>=0 && u_neighbor[i]<D_width && v_neighbor[i]<D_height) {
-              
-              // get neighbor pixel address
-              addr_neighbor = getAddressOffsetImage(u_neighbor[i],v_neighbor[i],D_width);
-              
-              // check if neighbor has not been added yet and if it is valid
-              if (*(D_done+addr_neighbor)==0 && *(D+addr_neighbor)>=0) {
-
-                // is the neighbor similar to the current pixel
-                // (=belonging to the current segment)
-                if (fabs(*(D+addr_curr)-*(D+addr_neighbor))<=param.speckle_sim_threshold) {
-                  
-                  // add neighbor coordinates to segment list
-                  *(seg_list_u+seg_list_count) = u_neighbor[i];
-                  *(seg_list_v+seg_list_count) = v_neighbor[i];
-                  seg_list_count++;            
-                  
-                  // set neighbor pixel in I_done to "done"
-                  // (otherwise a pixel may be added 2 times to the list, as
-                  //  neighbor of one pixel and as neighbor of another pixel)
-                  *(D_done+addr_neighbor) = 1;
-                }
-              }
-              
-            } 
-          }
-          
-          // set current pixel in seg_list to "done"
-          seg_list_curr++;
-          
-          // set current pixel in I_done to "done"
-          *(D_done+addr_curr) = 1;
+// orders (address, disparity) pairs by address
+static inline bool address_less (const pair<int32_t,float> &a,int32_t addr) {
+  return a.first<addr;
+}
 
-        } // end: while (seg_list_curr<seg_list_count)
-        
-        // if segment NOT large enough => invalidate pixels
-        if (seg_list_count<D_speckle_size) {
-          
-          // for all pixels in current segment invalidate pixels
-          for (int32_t i=0; i<seg_list_count; i++) {
-            addr_curr = getAddressOffsetImage(*(seg_list_u+i),*(seg_list_v+i),D_width);
-            *(D+addr_curr) = -10;
-          }
-        }
-      } // end: if (*(I_done+addr_start)==0)
-      
+template <typename TD>
+void Elas::removeSmallSegments (TD* D,int32_t v_begin,int32_t v_end) {
+  
+  const int32_t  D_width   = width/subsamplingStep();
+  const TD       invalid   = -10*disparityScale(D);
+  const int32_t* row_first = speckle_row_first_.data();
+  const int32_t* u0        = speckle_u0_.data();
+  const int32_t* u1        = speckle_u1_.data();
+  const int32_t* parent    = speckle_parent_.data();
+  const uint8_t* remove    = speckle_remove_.data();
+  
+  // invalidate small segments and the invalid pixels between the runs
+  const bool invalidate_gaps = speckleSize()>1;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=v_begin; v<v_end; v++) {
+    TD*     D_line = D+v*D_width;
+    int32_t u      = 0;
+    for (int32_t r=row_first[v]; r<row_first[v+1]; r++) {
+      if (invalidate_gaps)
+        for (; u<u0[r]; u++)
+          D_line[u] = invalid;
+      u = u1[r];
+      if (remove[parent[r]])
+        for (int32_t k=u0[r]; k<u; k++)
+          D_line[k] = invalid;
     }
+    if (invalidate_gaps)
+      for (; u<D_width; u++)
+        D_line[u] = invalid;
   }
   
-  // free memory
-  free(D_done);
-  free(seg_list_u);
-  free(seg_list_v);
+  // surviving invalid seeds keep their values
+  const vector<pair<int32_t,float> > &kept = speckle_kept_;
+#ifdef _OPENMP
+#pragma omp single
+#endif
+  for (vector<pair<int32_t,float> >::const_iterator it=lower_bound(kept.begin(),kept.end(),v_begin*D_width,address_less);
+       it!=kept.end() && it->first<v_end*D_width; it++)
+    D[it->first] = it->second;
+}
+
+// value filled into a gap between the disparities d1 and d2: their mean,
+// or the smaller one (background) across a discontinuity
+static inline float gap_value (float d1,float d2,float discon_threshold) {
+  if (fabs(d1-d2)<discon_threshold) return (d1+d2)/2;
+  else                              return min(d1,d2);
+}
+
+// validity (d>=0) of 4 consecutive disparities as 32 bit lane masks
+static inline __m128i valid_mask4 (const float* D) {
+  return _mm_castps_si128(_mm_cmpge_ps(_mm_loadu_ps(D),_mm_setzero_ps()));
+}
+
+static inline __m128i valid_mask4 (const int16_t* D) {
+  __m128i x = _mm_loadl_epi64((const __m128i*)D);
+  x = _mm_srai_epi32(_mm_unpacklo_epi16(x,x),16);
+  return _mm_cmpgt_epi32(x,_mm_set1_epi32(-1));
+}
+
+// interpolates the gap [v_first,v_last] of column u (scale: disparity
+// units per pixel, int16 values are rounded as in fillPlane)
+template <typename TD>
+static inline void fill_column_gap (TD* D,int32_t D_width,int32_t u,int32_t v_first,int32_t v_last,
+                                    float discon_threshold,int32_t scale) {
+  TD d_ipol;
+  store_disparity(&d_ipol,gap_value(D[(v_first-1)*D_width+u],D[(v_last+1)*D_width+u],discon_threshold)/scale);
+  for (int32_t v=v_first; v<=v_last; v++)
+    D[v*D_width+u] = d_ipol;
+}
+
+int32_t Elas::ipolGapWidth () const {
+  const int32_t step = subsamplingStep();
+  if (step>1)
+    return param.ipol_gap_width/step+1;
+  return param.ipol_gap_width;
 }
 
-void Elas::gapInterpolation(float* D) {
+template <typename TD>
+void Elas::gapInterpolationRows (TD* D,int32_t v_begin,int32_t v_end) {
   
   // get disparity image dimensions
-  int32_t D_width          = width;
-  int32_t D_height         = height;
-  int32_t D_ipol_gap_width = param.ipol_gap_width;
-  if (param.subsampling) {
-    D_width          = width/2;
-    D_height         = height/2;
-    D_ipol_gap_width = param.ipol_gap_width/2+1;
-  }
+  int32_t D_width          = width/subsamplingStep();
+  int32_t D_ipol_gap_width = ipolGapWidth();
   
   // discontinuity threshold
-  float discon_threshold = 3.0;
+  float discon_threshold = 3.0*disparityScale(D);
   
-  // declare loop variables
-  int32_t count,addr,v_first,v_last,u_first,u_last;
-  float   d1,d2,d_ipol;
-  
-  // 1. Row-wise:
   // for each row do
-  for (int32_t v=0; v<D_height; v++) {
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=v_begin; v<v_end; v++) {
+    
+    TD* D_line = D+v*D_width;
     
     // init counter
-    count = 0;
+    int32_t count = 0;
     
     // for each element of the row do
     for (int32_t u=0; u<D_width; u++) {
       
-      // get address of this location
-      addr = getAddressOffsetImage(u,v,D_width);
-      
       // if disparity valid
-      if (*(D+addr)>=0) {
+      if (D_line[u]>=0) {
         
         // check if speckle is small enough
         if (count>=1 && count<=D_ipol_gap_width) {
           
           // first and last value for interpolation
-          u_first = u-count;
-          u_last  = u-1;
+          int32_t u_first = u-count;
+          int32_t u_last  = u-1;
           
           // if value in range
           if (u_first>0 && u_last<D_width-1) {
             
-            // compute mean disparity
-            d1 = *(D+getAddressOffsetImage(u_first-1,v,D_width));
-            d2 = *(D+getAddressOffsetImage(u_last+1,v,D_width));
-            if (fabs(d1-d2)<discon_threshold) d_ipol = (d1+d2)/2;
-            else                              d_ipol = min(d1,d2);
-            
-            // set all values to d_ipol
+            // set all values to the mean disparity (int16: rounded as in fillPlane)
+            TD d_ipol;
+            store_disparity(&d_ipol,gap_value(D_line[u_first-1],D_line[u_last+1],discon_threshold)/
+                                    disparityScale(D));
             for (int32_t u_curr=u_first; u_curr<=u_last; u_curr++)
-              *(D+getAddressOffsetImage(u_curr,v,D_width)) = d_ipol;
+              D_line[u_curr] = d_ipol;
           }
           
         }
@@ -1428,356 +2316,536 @@ void Elas::gapInterpolation(float* D) {
 
       // extrapolate to the left
       for (int32_t u=0; u<D_width; u++) {
-
-        // get address of this location
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // if disparity valid
-        if (*(D+addr)>=0) {
+        if (D_line[u]>=0) {
           for (int32_t u2=max(u-D_ipol_gap_width,0); u2<u; u2++)
-            *(D+getAddressOffsetImage(u2,v,D_width)) = *(D+addr);
+            D_line[u2] = D_line[u];
           break;
         }
       }
 
       // extrapolate to the right
       for (int32_t u=D_width-1; u>=0; u--) {
-
-        // get address of this location
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // if disparity valid
-        if (*(D+addr)>=0) {
+        if (D_line[u]>=0) {
           for (int32_t u2=u; u2<=min(u+D_ipol_gap_width,D_width-1); u2++)
-            *(D+getAddressOffsetImage(u2,v,D_width)) = *(D+addr);
+            D_line[u2] = D_line[u];
           break;
         }
       }
     }
   }
+}
 
-  // 2. Column-wise:
-  // for each column do
-  for (int32_t u=0; u<D_width; u++) {
+template <typename TD>
+void Elas::gapInterpolationColumns (TD* D,int32_t v_begin,int32_t v_end) {
+  
+  // get disparity image dimensions
+  int32_t D_width          = width/subsamplingStep();
+  int32_t D_ipol_gap_width = ipolGapWidth();
+  
+  // discontinuity threshold
+  float discon_threshold = 3.0*disparityScale(D);
+  
+  // the gap length of each column is kept between calls
+  int32_t* count = gap_count_.data();
+  
+  // bands of columns are swept row by row (instead of striding down each
+  // column) with a gap counter per column, 4 columns at once. A gap ends
+  // at a valid pixel with 1<=count<=D_ipol_gap_width and count<v (the gap
+  // does not touch the top border).
+  const int32_t band_width = 64;
+  const __m128i xzero      = _mm_setzero_si128();
+  const __m128i xgap_width = _mm_set1_epi32(D_ipol_gap_width);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t u_band=0; u_band<D_width; u_band+=band_width) {
     
-    // init counter
-    count = 0;
+    const int32_t u_end = min(u_band+band_width,D_width);
     
-    // for each element of the column do
-    for (int32_t v=0; v<D_height; v++) {
+    for (int32_t v=v_begin; v<v_end; v++) {
       
-      // get address of this location
-      addr = getAddressOffsetImage(u,v,D_width);
+      const TD* D_line = D+v*D_width;
+      const __m128i xv = _mm_set1_epi32(v);
       
-      // if disparity valid
-      if (*(D+addr)>=0) {
+      int32_t u = u_band;
+      for (; u+4<=u_end; u+=4) {
+        int32_t* count_u = count+u;
+        __m128i xvalid = valid_mask4(D_line+u);
+        __m128i xcount = _mm_loadu_si128((__m128i*)count_u);
+        __m128i xfill  = _mm_andnot_si128(_mm_cmpeq_epi32(xcount,xzero),xvalid);
+        xfill = _mm_andnot_si128(_mm_cmpgt_epi32(xcount,xgap_width),xfill);
+        xfill = _mm_and_si128(_mm_cmplt_epi32(xcount,xv),xfill);
+        int32_t mask = _mm_movemask_ps(_mm_castsi128_ps(xfill));
+        for (int32_t k=0; mask; k++, mask>>=1)
+          if (mask&1)
+            fill_column_gap(D,D_width,u+k,v-count_u[k],v-1,discon_threshold,disparityScale(D));
         
-        // check if gap is small enough
-        if (count>=1 && count<=D_ipol_gap_width) {
-          
-          // first and last value for interpolation
-          v_first = v-count;
-          v_last  = v-1;
-          
-          // if value in range
-          if (v_first>0 && v_last<D_height-1) {
-            
-            // compute mean disparity
-            d1 = *(D+getAddressOffsetImage(u,v_first-1,D_width));
-            d2 = *(D+getAddressOffsetImage(u,v_last+1,D_width));
-            if (fabs(d1-d2)<discon_threshold) d_ipol = (d1+d2)/2;
-            else                              d_ipol = min(d1,d2);
-            
-            // set all values to d_ipol
-            for (int32_t v_curr=v_first; v_curr<=v_last; v_curr++)
-              *(D+getAddressOffsetImage(u,v_curr,D_width)) = d_ipol;
-          }
-          
+        // reset the counters of valid pixels, increment the others
+        xcount = _mm_andnot_si128(xvalid,_mm_sub_epi32(xcount,_mm_set1_epi32(-1)));
+        _mm_storeu_si128((__m128i*)count_u,xcount);
+      }
+      for (; u<u_end; u++) {
+        int32_t &c = count[u];
+        if (D_line[u]>=0) {
+          if (c>=1 && c<=D_ipol_gap_width && c<v)
+            fill_column_gap(D,D_width,u,v-c,v-1,discon_threshold,disparityScale(D));
+          c = 0;
+        } else {
+          c++;
         }
-        
-        // reset counter
-        count = 0;
-      
-      // otherwise increment counter
-      } else {
-        count++;
       }
     }
   }
 }
 
-// implements approximation to bilateral filtering
-void Elas::adaptiveMean (float* D) {
-  
-  // get disparity image dimensions
-  int32_t D_width          = width;
-  int32_t D_height         = height;
-  if (param.subsampling) {
-    D_width          = width/2;
-    D_height         = height/2;
-  }
-  
-  // allocate temporary memory
-  float* D_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  float* D_tmp  = (float*)malloc(D_width*D_height*sizeof(float));
-  memcpy(D_copy,D,D_width*D_height*sizeof(float));
-  
-  // zero input disparity maps to -10 (this makes the bilateral
-  // weights of all valid disparities to 0 in this region)
-  for (int32_t i=0; i<D_width*D_height; i++) {
-    if (*(D+i)<0) {
-      *(D_copy+i) = -10;
-      *(D_tmp+i)  = -10;
-    }
-  }
-  
-  __m128 xconst0 = _mm_set1_ps(0);
-  __m128 xconst4 = _mm_set1_ps(4);
-  __m128 xval,xweight1,xweight2,xfactor1,xfactor2;
-  
-  float *val     = (float *)_mm_malloc(8*sizeof(float),16);
-  float *weight  = (float*)_mm_malloc(4*sizeof(float),16);
-  float *factor  = (float*)_mm_malloc(4*sizeof(float),16);
-  
-  // set absolute mask
-  __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
-  
-  // when doing subsampling: 4 pixel bilateral filter width
-  if (param.subsampling) {
-  
-    // horizontal filter
-    for (int32_t v=3; v<D_height-3; v++) {
-
-      // init
-      for (int32_t u=0; u<3; u++)
-        val[u] = *(D_copy+v*D_width+u);
-
-      // loop
-      for (int32_t u=3; u<D_width; u++) {
-
-        // set
-        float val_curr = *(D_copy+v*D_width+(u-1));
-        val[u%4] = *(D_copy+v*D_width+u);
+// mask ? b : a
+static inline __m128 select_ps (const __m128 &mask,const __m128 &a,const __m128 &b) {
+  return _mm_or_ps(_mm_and_ps(mask,b),_mm_andnot_ps(mask,a));
+}
 
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
+// bilateral mean of the adaptive mean filter for 4 pixels: x[i] holds
+// ring slot i of each window (the slot order fixes the order of the float
+// sums), c the center disparities. valid flags pixels with a positive
+// weight sum and a non-negative mean. As in the original filter the "abs
+// mask" is the float 2^31 (bits 0x4F000000), which keeps only some
+// exponent bits of x-c: the weights are 4 for |x-c|<2, 2 for |x-c|<8 and 0
+// beyond, bilateral_mean16 uses the same kernel.
+template <int32_t N>
+static inline __m128 bilateral_mean4 (const __m128* x,const __m128 &c,__m128 &valid) {
+  const __m128 xconst0  = _mm_set1_ps(0);
+  const __m128 xconst4  = _mm_set1_ps(4);
+  const __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
+  __m128 w[N],f[N];
+  for (int32_t i=0; i<N; i++) {
+    w[i] = _mm_and_ps(_mm_sub_ps(x[i],c),xabsmask);
+    w[i] = _mm_max_ps(xconst0,_mm_sub_ps(xconst4,w[i]));
+    f[i] = _mm_mul_ps(x[i],w[i]);
+  }
+  for (int32_t i=0; i+4<N; i++) {
+    w[i] = _mm_add_ps(w[i],w[i+4]);
+    f[i] = _mm_add_ps(f[i],f[i+4]);
+  }
+  __m128 weight_sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(w[0],w[1]),w[2]),w[3]);
+  __m128 factor_sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(f[0],f[1]),f[2]),f[3]);
+  __m128 d = _mm_div_ps(factor_sum,weight_sum);
+  valid = _mm_and_ps(_mm_cmpgt_ps(weight_sum,xconst0),_mm_cmpge_ps(d,xconst0));
+  return d;
+}
 
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
+#ifdef __AVX2__
+// 8 pixel version of the above
+template <int32_t N>
+static inline __m256 bilateral_mean8 (const __m256* x,const __m256 &c,__m256 &valid) {
+  const __m256 xconst0  = _mm256_set1_ps(0);
+  const __m256 xconst4  = _mm256_set1_ps(4);
+  const __m256 xabsmask = _mm256_set1_ps(0x7FFFFFFF);
+  __m256 w[N],f[N];
+  for (int32_t i=0; i<N; i++) {
+    w[i] = _mm256_and_ps(_mm256_sub_ps(x[i],c),xabsmask);
+    w[i] = _mm256_max_ps(xconst0,_mm256_sub_ps(xconst4,w[i]));
+    f[i] = _mm256_mul_ps(x[i],w[i]);
+  }
+  for (int32_t i=0; i+4<N; i++) {
+    w[i] = _mm256_add_ps(w[i],w[i+4]);
+    f[i] = _mm256_add_ps(f[i],f[i+4]);
+  }
+  __m256 weight_sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(w[0],w[1]),w[2]),w[3]);
+  __m256 factor_sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(f[0],f[1]),f[2]),f[3]);
+  __m256 d = _mm256_div_ps(factor_sum,weight_sum);
+  valid = _mm256_and_ps(_mm256_cmp_ps(weight_sum,xconst0,_CMP_GT_OQ),_mm256_cmp_ps(d,xconst0,_CMP_GE_OQ));
+  return d;
+}
+#endif
 
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D_tmp+v*D_width+(u-1)) = d;
-        }
-      }
+// horizontal adaptive mean of one row: out[o] is the bilateral mean of
+// in[o-N/2..o+N/2-1] around in[o], for o in [N/2,D_width-N/2+1). Ring slot
+// i of a window holds the position p=i (mod N), so for a block of pixels
+// each slot is a broadcast position that later pixels replace by the next
+// position with the same residue.
+template <int32_t N>
+static void adaptive_mean_row (const float* in,float* out,int32_t D_width) {
+  const int32_t o_end = D_width-N/2+1;
+  int32_t o = N/2;
+#ifdef __AVX2__
+  const __m256i xlane8 = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  for (; o+8<=o_end; o+=8) {
+    const int32_t u = o+N/2-1; // last window position of the first pixel
+    __m256 x[N],valid;
+    for (int32_t i=0; i<N; i++) {
+      int32_t p = u-(u-i)%N;
+      x[i] = _mm256_set1_ps(in[p]);
+      for (p+=N; p<=u+7; p+=N)
+        x[i] = _mm256_blendv_ps(x[i],_mm256_set1_ps(in[p]),
+                                _mm256_castsi256_ps(_mm256_cmpgt_epi32(xlane8,_mm256_set1_epi32(p-u-1))));
     }
+    __m256 d = bilateral_mean8<N>(x,_mm256_loadu_ps(in+o),valid);
+    _mm256_storeu_ps(out+o,_mm256_blendv_ps(_mm256_loadu_ps(out+o),d,valid));
+  }
+#endif
+  const __m128i xlane4 = _mm_setr_epi32(0,1,2,3);
+  for (; o+4<=o_end; o+=4) {
+    const int32_t u = o+N/2-1;
+    __m128 x[N],valid;
+    for (int32_t i=0; i<N; i++) {
+      int32_t p = u-(u-i)%N;
+      x[i] = _mm_set1_ps(in[p]);
+      for (p+=N; p<=u+3; p+=N)
+        x[i] = select_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(xlane4,_mm_set1_epi32(p-u-1))),x[i],_mm_set1_ps(in[p]));
+    }
+    __m128 d = bilateral_mean4<N>(x,_mm_loadu_ps(in+o),valid);
+    _mm_storeu_ps(out+o,select_ps(valid,_mm_loadu_ps(out+o),d));
+  }
+  for (; o<o_end; o++) {
+    const int32_t u = o+N/2-1;
+    __m128 x[N],valid;
+    for (int32_t i=0; i<N; i++)
+      x[i] = _mm_set1_ps(in[u-(u-i)%N]);
+    __m128 d = bilateral_mean4<N>(x,_mm_set1_ps(in[o]),valid);
+    if (_mm_movemask_ps(valid)&1)
+      out[o] = _mm_cvtss_f32(d);
+  }
+}
 
-    // vertical filter
-    for (int32_t u=3; u<D_width-3; u++) {
-
-      // init
-      for (int32_t v=0; v<3; v++)
-        val[v] = *(D_tmp+v*D_width+u);
-
-      // loop
-      for (int32_t v=3; v<D_height; v++) {
-
-        // set
-        float val_curr = *(D_tmp+(v-1)*D_width+u);
-        val[v%4] = *(D_tmp+v*D_width+u);
-
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
-
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
+// vertical adaptive mean of row o for the columns [3,D_width-3): ring
+// slot i is the row r=i (mod N) of [o-N/2,o+N/2-1], the same for all columns
+template <int32_t N>
+static void adaptive_mean_column (const float* in,float* out,int32_t D_width,int32_t o) {
+  const int32_t v = o+N/2-1;
+  const float* row[N];
+  for (int32_t i=0; i<N; i++)
+    row[i] = in+(v-(v-i)%N)*D_width;
+  const float* center   = in+o*D_width;
+  float*       out_line = out+o*D_width;
+  int32_t u = 3;
+#ifdef __AVX2__
+  for (; u+8<=D_width-3; u+=8) {
+    __m256 x[N],valid;
+    for (int32_t i=0; i<N; i++)
+      x[i] = _mm256_loadu_ps(row[i]+u);
+    __m256 d = bilateral_mean8<N>(x,_mm256_loadu_ps(center+u),valid);
+    _mm256_storeu_ps(out_line+u,_mm256_blendv_ps(_mm256_loadu_ps(out_line+u),d,valid));
+  }
+#endif
+  for (; u+4<=D_width-3; u+=4) {
+    __m128 x[N],valid;
+    for (int32_t i=0; i<N; i++)
+      x[i] = _mm_loadu_ps(row[i]+u);
+    __m128 d = bilateral_mean4<N>(x,_mm_loadu_ps(center+u),valid);
+    _mm_storeu_ps(out_line+u,select_ps(valid,_mm_loadu_ps(out_line+u),d));
+  }
+  for (; u<D_width-3; u++) {
+    __m128 x[N],valid;
+    for (int32_t i=0; i<N; i++)
+      x[i] = _mm_set1_ps(row[i][u]);
+    __m128 d = bilateral_mean4<N>(x,_mm_set1_ps(center[u]),valid);
+    if (_mm_movemask_ps(valid)&1)
+      out_line[u] = _mm_cvtss_f32(d);
+  }
+}
 
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D+(v-1)*D_width+u) = d;
-        }
-      }
-    }
-    
+// implements approximation to bilateral filtering, horizontal pass: the
+// rows are copied with invalid disparities set to -10 (this makes the
+// bilateral weights of all valid disparities to 0 in this region) and
+// filtered into D_tmp, pixels not reached by the filter keep their value
+void Elas::adaptiveMeanRows (float* D,int32_t v_begin,int32_t v_end) {
+  
+  // get disparity image dimensions
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  
+  // workspace, sized by postProcess()
+  float* D_copy = mean_copy_.data();
+  float* D_tmp  = mean_tmp_.data();
+  
+  // when doing subsampling: 4 pixel bilateral filter width,
   // full resolution: 8 pixel bilateral filter width
-  } else {
-    
+  const int32_t taps = step>1 ? 4 : 8;
   
-    // horizontal filter
-    for (int32_t v=3; v<D_height-3; v++) {
-
-      // init
-      for (int32_t u=0; u<7; u++)
-        val[u] = *(D_copy+v*D_width+u);
-
-      // loop
-      for (int32_t u=7; u<D_width; u++) {
-
-        // set
-        float val_curr = *(D_copy+v*D_width+(u-3));
-        val[u%8] = *(D_copy+v*D_width+u);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=v_begin; v<v_end; v++) {
+    const float* D_line    = D+v*D_width;
+    float*       copy_line = D_copy+v*D_width;
+    float*       tmp_line  = D_tmp+v*D_width;
+    for (int32_t u=0; u<D_width; u++)
+      copy_line[u] = tmp_line[u] = D_line[u]<0 ? -10 : D_line[u];
+    if (v<3 || v>=D_height-3)
+      continue;
+    if (taps==4) adaptive_mean_row<4>(copy_line,tmp_line,D_width);
+    else         adaptive_mean_row<8>(copy_line,tmp_line,D_width);
+  }
+}
 
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
+// vertical pass, needs the horizontal pass of taps/2 rows above and
+// taps/2-1 rows below
+void Elas::adaptiveMeanColumns (float* D,int32_t v_begin,int32_t v_end) {
+  
+  // get disparity image dimensions
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  const int32_t taps       = step>1 ? 4 : 8;
+  
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=max(v_begin,taps/2); v<min(v_end,D_height-taps/2+1); v++) {
+    if (taps==4) adaptive_mean_column<4>(mean_tmp_.data(),D,D_width,v);
+    else         adaptive_mean_column<8>(mean_tmp_.data(),D,D_width,v);
+  }
+}
 
-        xval     = _mm_load_ps(val+4);      
-        xweight2 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight2 = _mm_and_ps(xweight2,xabsmask);
-        xweight2 = _mm_sub_ps(xconst4,xweight2);
-        xweight2 = _mm_max_ps(xconst0,xweight2);
-        xfactor2 = _mm_mul_ps(xval,xweight2);
+// rounded quotient (f+w/2)/w of non-negative int32 lanes, exact in double
+static inline __m128i div_round_epi32 (const __m128i &f,const __m128i &w) {
+  __m128i n    = _mm_add_epi32(f,_mm_srai_epi32(w,1));
+  __m128d q_lo = _mm_div_pd(_mm_cvtepi32_pd(n),_mm_cvtepi32_pd(w));
+  __m128d q_hi = _mm_div_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(n,_MM_SHUFFLE(3,2,3,2))),
+                            _mm_cvtepi32_pd(_mm_shuffle_epi32(w,_MM_SHUFFLE(3,2,3,2))));
+  return _mm_unpacklo_epi64(_mm_cvttpd_epi32(q_lo),_mm_cvttpd_epi32(q_hi));
+}
 
-        xweight1 = _mm_add_ps(xweight1,xweight2);
-        xfactor1 = _mm_add_ps(xfactor1,xfactor2);
+// int16 bilateral mean for 8 pixels with the weights of the float filter
+// (4 for |x-c|<2 pixels, 2 for |x-c|<8 pixels, 0 beyond): x[k] holds window
+// element k of each pixel (integer sums do not depend on the order), c the
+// centers. valid flags pixels with a positive weight sum and a non-negative
+// mean.
+template <int32_t N>
+static inline __m128i bilateral_mean16 (const __m128i* x,const __m128i &c,__m128i &valid) {
+  const __m128i xzero = _mm_setzero_si128();
+  const __m128i xtwo  = _mm_set1_epi16(2);
+  __m128i ws    = xzero;
+  __m128i fs_lo = xzero;
+  __m128i fs_hi = xzero;
+  for (int32_t k=0; k<N; k++) {
+    __m128i ad = _mm_max_epi16(_mm_sub_epi16(x[k],c),_mm_sub_epi16(c,x[k]));
+    __m128i w  = _mm_add_epi16(_mm_and_si128(_mm_cmplt_epi16(ad,_mm_set1_epi16(2*16)),xtwo),
+                               _mm_and_si128(_mm_cmplt_epi16(ad,_mm_set1_epi16(8*16)),xtwo));
+    __m128i lo = _mm_mullo_epi16(x[k],w);
+    __m128i hi = _mm_mulhi_epi16(x[k],w);
+    ws    = _mm_add_epi16(ws,w);
+    fs_lo = _mm_add_epi32(fs_lo,_mm_unpacklo_epi16(lo,hi));
+    fs_hi = _mm_add_epi32(fs_hi,_mm_unpackhi_epi16(lo,hi));
+  }
+  __m128i ws_lo = _mm_unpacklo_epi16(ws,xzero);
+  __m128i ws_hi = _mm_unpackhi_epi16(ws,xzero);
+  valid = _mm_packs_epi32(_mm_andnot_si128(_mm_cmplt_epi32(fs_lo,xzero),_mm_cmpgt_epi32(ws_lo,xzero)),
+                          _mm_andnot_si128(_mm_cmplt_epi32(fs_hi,xzero),_mm_cmpgt_epi32(ws_hi,xzero)));
+  return _mm_packs_epi32(div_round_epi32(fs_lo,ws_lo),div_round_epi32(fs_hi,ws_hi));
+}
 
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
+// int16 filter pass over the pixels [u_begin,u_end) of a row: x_first
+// points to the first window element of pixel u_begin, consecutive window
+// elements are x_stride apart
+template <int32_t N>
+static void adaptive_mean16_pass (const int16_t* x_first,int32_t x_stride,const int16_t* center,int16_t* out,
+                                  int32_t u_begin,int32_t u_end) {
+  int32_t u = u_begin;
+  for (; u+8<=u_end; u+=8) {
+    __m128i x[N],valid;
+    for (int32_t k=0; k<N; k++)
+      x[k] = _mm_loadu_si128((const __m128i*)(x_first+(u-u_begin)+k*x_stride));
+    __m128i d = bilateral_mean16<N>(x,_mm_loadu_si128((const __m128i*)(center+u)),valid);
+    __m128i d_old = _mm_loadu_si128((const __m128i*)(out+u));
+    _mm_storeu_si128((__m128i*)(out+u),_mm_or_si128(_mm_and_si128(valid,d),_mm_andnot_si128(valid,d_old)));
+  }
+  for (; u<u_end; u++) {
+    __m128i x[N],valid;
+    for (int32_t k=0; k<N; k++)
+      x[k] = _mm_set1_epi16(x_first[(u-u_begin)+k*x_stride]);
+    __m128i d = bilateral_mean16<N>(x,_mm_set1_epi16(center[u]),valid);
+    if (_mm_cvtsi128_si32(valid)&1)
+      out[u] = _mm_extract_epi16(d,0);
+  }
+}
 
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D_tmp+v*D_width+(u-3)) = d;
-        }
-      }
-    }
+// int16 version of the filters above, 8 pixels per iteration
+void Elas::adaptiveMeanRows (int16_t* D,int32_t v_begin,int32_t v_end) {
   
-    // vertical filter
-    for (int32_t u=3; u<D_width-3; u++) {
+  // get disparity image dimensions
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  
+  // workspace, sized by postProcess()
+  int16_t* D_copy = mean_copy16_.data();
+  int16_t* D_tmp  = mean_tmp16_.data();
+  
+  const int32_t taps = step>1 ? 4 : 8;
+  
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=v_begin; v<v_end; v++) {
+    const int16_t* D_line    = D+v*D_width;
+    int16_t*       copy_line = D_copy+v*D_width;
+    int16_t*       tmp_line  = D_tmp+v*D_width;
+    for (int32_t u=0; u<D_width; u++)
+      copy_line[u] = tmp_line[u] = D_line[u]<0 ? disp16_invalid : D_line[u];
+    if (v<3 || v>=D_height-3)
+      continue;
+    if (taps==4) adaptive_mean16_pass<4>(copy_line,1,copy_line,tmp_line,2,D_width-1);
+    else         adaptive_mean16_pass<8>(copy_line,1,copy_line,tmp_line,4,D_width-3);
+  }
+}
 
-      // init
-      for (int32_t v=0; v<7; v++)
-        val[v] = *(D_tmp+v*D_width+u);
+void Elas::adaptiveMeanColumns (int16_t* D,int32_t v_begin,int32_t v_end) {
+  
+  // get disparity image dimensions
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  const int32_t taps       = step>1 ? 4 : 8;
+  const int16_t* D_tmp     = mean_tmp16_.data();
+  
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=max(v_begin,taps/2); v<min(v_end,D_height-taps/2+1); v++) {
+    const int16_t* x_first = D_tmp+(v-taps/2)*D_width+3;
+    if (taps==4) adaptive_mean16_pass<4>(x_first,D_width,D_tmp+v*D_width,D+v*D_width,3,D_width-3);
+    else         adaptive_mean16_pass<8>(x_first,D_width,D_tmp+v*D_width,D+v*D_width,3,D_width-3);
+  }
+}
 
-      // loop
-      for (int32_t v=7; v<D_height; v++) {
+// element-wise min/max of scalars and vectors for the median network
+static inline float   median_min (float a,float b)     { return min(a,b); }
+static inline float   median_max (float a,float b)     { return max(a,b); }
+static inline int16_t median_min (int16_t a,int16_t b) { return min(a,b); }
+static inline int16_t median_max (int16_t a,int16_t b) { return max(a,b); }
+static inline __m128  median_min (__m128 a,__m128 b)   { return _mm_min_ps(a,b); }
+static inline __m128  median_max (__m128 a,__m128 b)   { return _mm_max_ps(a,b); }
+static inline __m128i median_min (__m128i a,__m128i b) { return _mm_min_epi16(a,b); }
+static inline __m128i median_max (__m128i a,__m128i b) { return _mm_max_epi16(a,b); }
+#ifdef __AVX2__
+static inline __m256  median_min (__m256 a,__m256 b)   { return _mm256_min_ps(a,b); }
+static inline __m256  median_max (__m256 a,__m256 b)   { return _mm256_max_ps(a,b); }
+static inline __m256i median_min (__m256i a,__m256i b) { return _mm256_min_epi16(a,b); }
+static inline __m256i median_max (__m256i a,__m256i b) { return _mm256_max_epi16(a,b); }
+#endif
 
-        // set
-        float val_curr = *(D_tmp+(v-3)*D_width+u);
-        val[v%8] = *(D_tmp+v*D_width+u);
+// compare-exchange: a=min(a,b), b=max(a,b)
+template <typename V>
+static inline void median_sort (V &a,V &b) {
+  V lo = median_min(a,b);
+  b = median_max(a,b);
+  a = lo;
+}
 
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
+// median of 7 values by a branch-free selection network of 13
+// compare-exchanges, lane-wise for vectors
+template <typename V>
+static inline V median7 (V* p) {
+  median_sort(p[0],p[5]); median_sort(p[0],p[3]); median_sort(p[1],p[6]);
+  median_sort(p[2],p[4]); median_sort(p[0],p[1]); median_sort(p[3],p[5]);
+  median_sort(p[2],p[6]); median_sort(p[2],p[3]); median_sort(p[3],p[6]);
+  median_sort(p[4],p[5]); median_sort(p[1],p[4]); median_sort(p[1],p[3]);
+  median_sort(p[3],p[4]);
+  return p[3];
+}
 
-        xval     = _mm_load_ps(val+4);      
-        xweight2 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight2 = _mm_and_ps(xweight2,xabsmask);
-        xweight2 = _mm_sub_ps(xconst4,xweight2);
-        xweight2 = _mm_max_ps(xconst0,xweight2);
-        xfactor2 = _mm_mul_ps(xval,xweight2);
+// median filter of a block of median_block_bytes: out[u] is the median of
+// x[u+k*stride] (k=0..6) where D_line[u] is valid and D_line[u] elsewhere
+#ifdef __AVX2__
+static const int32_t median_block_bytes = 32;
+#else
+static const int32_t median_block_bytes = 16;
+#endif
 
-        xweight1 = _mm_add_ps(xweight1,xweight2);
-        xfactor1 = _mm_add_ps(xfactor1,xfactor2);
+static inline void median7_block (const float* x,int32_t stride,const float* D_line,float* out) {
+#ifdef __AVX2__
+  __m256 p[7];
+  for (int32_t k=0; k<7; k++)
+    p[k] = _mm256_loadu_ps(x+k*stride);
+  __m256 d = _mm256_loadu_ps(D_line);
+  _mm256_storeu_ps(out,_mm256_blendv_ps(d,median7(p),_mm256_cmp_ps(d,_mm256_setzero_ps(),_CMP_GE_OQ)));
+#else
+  __m128 p[7];
+  for (int32_t k=0; k<7; k++)
+    p[k] = _mm_loadu_ps(x+k*stride);
+  __m128 d = _mm_loadu_ps(D_line);
+  _mm_storeu_ps(out,select_ps(_mm_cmpge_ps(d,_mm_setzero_ps()),d,median7(p)));
+#endif
+}
 
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
+static inline void median7_block (const int16_t* x,int32_t stride,const int16_t* D_line,int16_t* out) {
+#ifdef __AVX2__
+  __m256i p[7];
+  for (int32_t k=0; k<7; k++)
+    p[k] = _mm256_loadu_si256((const __m256i*)(x+k*stride));
+  __m256i d = _mm256_loadu_si256((const __m256i*)D_line);
+  __m256i valid = _mm256_cmpgt_epi16(d,_mm256_set1_epi16(-1));
+  _mm256_storeu_si256((__m256i*)out,_mm256_blendv_epi8(d,median7(p),valid));
+#else
+  __m128i p[7];
+  for (int32_t k=0; k<7; k++)
+    p[k] = _mm_loadu_si128((const __m128i*)(x+k*stride));
+  __m128i d = _mm_loadu_si128((const __m128i*)D_line);
+  __m128i valid = _mm_cmpgt_epi16(d,_mm_set1_epi16(-1));
+  _mm_storeu_si128((__m128i*)out,_mm_or_si128(_mm_and_si128(valid,median7(p)),_mm_andnot_si128(valid,d)));
+#endif
+}
 
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D+(v-3)*D_width+u) = d;
-        }
-      }
-    }
+// median filter of the pixels [u_begin,u_end) of a row, in blocks and
+// pixel by pixel for the rest
+template <typename TD>
+static void median7_pass (const TD* x,int32_t stride,const TD* D_line,TD* out,int32_t u_begin,int32_t u_end) {
+  const int32_t block = median_block_bytes/sizeof(TD);
+  int32_t u = u_begin;
+  for (; u+block<=u_end; u+=block)
+    median7_block(x+u,stride,D_line+u,out+u);
+  for (; u<u_end; u++) {
+    TD p[7];
+    for (int32_t k=0; k<7; k++)
+      p[k] = x[u+k*stride];
+    out[u] = D_line[u]>=0 ? median7(p) : D_line[u];
   }
-  
-  // free memory
-  _mm_free(val);
-  _mm_free(weight);
-  _mm_free(factor);
-  free(D_copy);
-  free(D_tmp);
 }
 
-void Elas::median (float* D) {
+// horizontal median pass into the median buffer, whose rows outside the
+// filtered range stay 0 (they enter the vertical windows at the borders)
+template <typename TD>
+void Elas::medianRows (TD* D,int32_t v_begin,int32_t v_end) {
   
   // get disparity image dimensions
-  int32_t D_width          = width;
-  int32_t D_height         = height;
-  if (param.subsampling) {
-    D_width          = width/2;
-    D_height         = height/2;
-  }
-
-  // temporary memory
-  float *D_temp = (float*)calloc(D_width*D_height,sizeof(float));
-  
-  int32_t window_size = 3;
-  
-  float *vals = new float[window_size*2+1];
-  int32_t i,j;
-  float temp;
-  
-  // first step: horizontal median filter
-  for (int32_t u=window_size; u<D_width-window_size; u++) {
-    for (int32_t v=window_size; v<D_height-window_size; v++) {
-      if (*(D+getAddressOffsetImage(u,v,D_width))>=0) {    
-        j = 0;
-        for (int32_t u2=u-window_size; u2<=u+window_size; u2++) {
-          temp = *(D+getAddressOffsetImage(u2,v,D_width));
-          i = j-1;
-          while (i>=0 && *(vals+i)>temp) {
-            *(vals+i+1) = *(vals+i);
-            i--;
-          }
-          *(vals+i+1) = temp;
-          j++;
-        }
-        *(D_temp+getAddressOffsetImage(u,v,D_width)) = *(vals+window_size);
-      } else {
-        *(D_temp+getAddressOffsetImage(u,v,D_width)) = *(D+getAddressOffsetImage(u,v,D_width));
-      }
-        
-    }
-  }
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  int32_t window_size      = 3;
   
-  // second step: vertical median filter
-  for (int32_t u=window_size; u<D_width-window_size; u++) {
-    for (int32_t v=window_size; v<D_height-window_size; v++) {
-      if (*(D+getAddressOffsetImage(u,v,D_width))>=0) {
-        j = 0;
-        for (int32_t v2=v-window_size; v2<=v+window_size; v2++) {
-          temp = *(D_temp+getAddressOffsetImage(u,v2,D_width));
-          i = j-1;
-          while (i>=0 && *(vals+i)>temp) {
-            *(vals+i+1) = *(vals+i);
-            i--;
-          }
-          *(vals+i+1) = temp;
-          j++;
-        }
-        *(D+getAddressOffsetImage(u,v,D_width)) = *(vals+window_size);
-      } else {
-        *(D+getAddressOffsetImage(u,v,D_width)) = *(D+getAddressOffsetImage(u,v,D_width));
-      }
-    }
+  // workspace, sized by postProcess()
+  TD* D_temp = medianBuffer(D).data();
+  
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=v_begin; v<v_end; v++) {
+    const TD* D_line    = D+v*D_width;
+    TD*       temp_line = D_temp+v*D_width;
+    if (v<window_size || v>=D_height-window_size)
+      memset(temp_line,0,D_width*sizeof(TD));
+    else
+      median7_pass(D_line-window_size,1,D_line,temp_line,window_size,D_width-window_size);
   }
+}
+
+// vertical median pass, needs the horizontal pass of 3 rows above and below
+template <typename TD>
+void Elas::medianColumns (TD* D,int32_t v_begin,int32_t v_end) {
   
-  free(D_temp);
-  free(vals);
+  // get disparity image dimensions
+  const int32_t step       = subsamplingStep();
+  int32_t D_width          = width/step;
+  int32_t D_height         = height/step;
+  int32_t window_size      = 3;
+  const TD* D_temp         = medianBuffer(D).data();
+  
+#ifdef _OPENMP
+#pragma omp for
+#endif
+  for (int32_t v=max(v_begin,window_size); v<min(v_end,D_height-window_size); v++) {
+    TD* D_line = D+v*D_width;
+    median7_pass(D_temp+(v-window_size)*D_width,D_width,D_line,D_line,window_size,D_width-window_size);
+  }
 }
@@ -22,13 +22,17 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 // Demo program showing how libelas can be used, try "./elas -h" for help
 
 #include <iostream>
+#include <vector>
+#include <math.h>
 #include "elas.h"
 #include "image.h"
 
 using namespace std;
 
-// compute disparities of pgm image input pair file_1, file_2
-void process (const char* file_1,const char* file_2) {
+// compute disparities of pgm image input pair file_1, file_2, returns false
+// if the images can't be processed
+bool computeDisparities (const char* file_1,const char* file_2,vector<float> &D1_data,
+                         vector<float> &D2_data,int32_t &width,int32_t &height) {
 
   cout << "Processing: " << file_1 << ", " << file_2 << endl;
 
@@ -45,23 +49,38 @@ void process (const char* file_1,const char* file_2) {
                  ", I2: " << I2->width() <<  " x " << I2->height() << endl;
     delete I1;
     delete I2;
-    return;    
+    return false;
   }
 
   // get image width and height
-  int32_t width  = I1->width();
-  int32_t height = I1->height();
+  width  = I1->width();
+  height = I1->height();
 
   // allocate memory for disparity images
   const int32_t dims[3] = {width,height,width}; // bytes per line = width
-  float* D1_data = (float*)malloc(width*height*sizeof(float));
-  float* D2_data = (float*)malloc(width*height*sizeof(float));
+  D1_data.assign(width*height,-1);
+  D2_data.assign(width*height,-1);
 
   // process
   Elas::parameters param;
   param.postprocess_only_left = false;
   Elas elas(param);
-  elas.process(I1->data,I2->data,D1_data,D2_data,dims);
+  elas.process(I1->data,I2->data,D1_data.data(),D2_data.data(),dims);
+
+  // free memory
+  delete I1;
+  delete I2;
+  return true;
+}
+
+// compute disparities of pgm image input pair file_1, file_2
+void process (const char* file_1,const char* file_2) {
+
+  // compute disparities
+  vector<float> D1_data,D2_data;
+  int32_t width,height;
+  if (!computeDisparities(file_1,file_2,D1_data,D2_data,width,height))
+    return;
 
   // find maximum disparity for scaling output disparity images to [0..255]
   float disp_max = 0;
@@ -91,12 +110,75 @@ void process (const char* file_1,const char* file_2) {
   savePGM(D2,output_2);
 
   // free memory
-  delete I1;
-  delete I2;
   delete D1;
   delete D2;
-  free(D1_data);
-  free(D2_data);
+}
+
+// save the float disparities of file_1, file_2 as regression baseline
+// (width, height, left and right disparities, raw binary)
+int saveBaseline (const char* file_1,const char* file_2,const char* baseline) {
+
+  vector<float> D1,D2;
+  int32_t dims[2];
+  if (!computeDisparities(file_1,file_2,D1,D2,dims[0],dims[1]))
+    return 1;
+
+  FILE *fp = fopen(baseline,"wb");
+  if (!fp) {
+    cout << "ERROR: Couldn't write " << baseline << endl;
+    return 1;
+  }
+  fwrite(dims,sizeof(int32_t),2,fp);
+  fwrite(D1.data(),sizeof(float),D1.size(),fp);
+  fwrite(D2.data(),sizeof(float),D2.size(),fp);
+  fclose(fp);
+  return 0;
+}
+
+// compare the float disparities of file_1, file_2 against a baseline written
+// by saveBaseline(), returns 1 if any disparity differs by more than tolerance
+int compareBaseline (const char* file_1,const char* file_2,const char* baseline,float tolerance) {
+
+  vector<float> D[2];
+  int32_t width,height;
+  if (!computeDisparities(file_1,file_2,D[0],D[1],width,height))
+    return 1;
+
+  // read baseline
+  FILE *fp = fopen(baseline,"rb");
+  if (!fp) {
+    cout << "ERROR: Couldn't read " << baseline << endl;
+    return 1;
+  }
+  int32_t dims[2] = {0,0};
+  vector<float> B[2];
+  bool ok = fread(dims,sizeof(int32_t),2,fp)==2 && dims[0]==width && dims[1]==height;
+  for (int32_t k=0; k<2 && ok; k++) {
+    B[k].resize(width*height);
+    ok = fread(B[k].data(),sizeof(float),B[k].size(),fp)==B[k].size();
+  }
+  fclose(fp);
+  if (!ok) {
+    cout << "ERROR: " << baseline << " is no baseline of a " << width << " x " << height << " pair" << endl;
+    return 1;
+  }
+
+  // count differing disparities of left and right image
+  int32_t num_diff = 0;
+  for (int32_t k=0; k<2; k++) {
+    int32_t num = 0;
+    float max_diff = 0;
+    for (int32_t i=0; i<width*height; i++) {
+      float diff = fabs(D[k][i]-B[k][i]);
+      if (diff>tolerance) num++;
+      if (diff>max_diff) max_diff = diff;
+    }
+    cout << (k ? "right: " : "left:  ") << num << " of " << width*height
+         << " disparities differ, max difference " << max_diff << endl;
+    num_diff += num;
+  }
+  cout << (num_diff ? "FAILED" : "passed") << endl;
+  return num_diff ? 1 : 0;
 }
 
 int main (int argc, char** argv) {
@@ -117,16 +199,25 @@ int main (int argc, char** argv) {
     process(argv[1],argv[2]);
     cout << "... done!" << endl;
 
+  // regression baseline of an input pair
+  } else if (argc==5 && !strcmp(argv[1],"save")) {
+    return saveBaseline(argv[2],argv[3],argv[4]);
+  } else if ((argc==5 || argc==6) && !strcmp(argv[1],"compare")) {
+    return compareBaseline(argv[2],argv[3],argv[4],argc==6 ? atof(argv[5]) : 0);
+
   // display help
   } else {
     cout << endl;
     cout << "ELAS demo program usage: " << endl;
     cout << "./elas demo ................ process all test images (image dir)" << endl;
     cout << "./elas left.pgm right.pgm .. process a single stereo pair" << endl;
+    cout << "./elas save left.pgm right.pgm base.bin ...... save float disparities as baseline" << endl;
+    cout << "./elas compare left.pgm right.pgm base.bin [t] compare against baseline (tolerance t)" << endl;
     cout << "./elas -h .................. shows this help" << endl;
     cout << endl;
     cout << "Note: All images must be pgm greylevel images. All output" << endl;
     cout << "      disparities will be scaled such that disp_max = 255." << endl;
+    cout << "      Dense disparities require the DO_EVERYTHING build option." << endl;
     cout << endl;
   }
 
@@ -634,6 +634,12 @@ struct mesh {
 
   struct otri recenttri;
 
+/* Array of vertex pointers sorted by divconqdelaunay(), kept between calls  */
+/*   of a triangulatecontext.                                                */
+
+  vertex *sortarray;
+  int sortarraysize;
+
 };                                                  /* End of `struct mesh'. */
 
 
@@ -1685,6 +1691,26 @@ void poolinit(struct memorypool *pool, int bytecount, int itemcount,
   poolrestart(pool);
 }
 
+/*****************************************************************************/
+/*                                                                           */
+/*  poolreinit()   Initialize a pool, or restart it if it already has        */
+/*                 memory allocated to it.                                   */
+/*                                                                           */
+/*  Used by a triangulatecontext, whose pools survive between calls.  The    */
+/*  item size and alignment must not change between calls.                   */
+/*                                                                           */
+/*****************************************************************************/
+
+void poolreinit(struct memorypool *pool, int bytecount, int itemcount,
+                int firstitemcount, int alignment)
+{
+  if (pool->firstblock != (int **) NULL) {
+    poolrestart(pool);
+  } else {
+    poolinit(pool, bytecount, itemcount, firstitemcount, alignment);
+  }
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /*  pooldeinit()   Free to the operating system all memory taken by a pool.  */
@@ -1874,8 +1900,10 @@ void dummyinit(struct mesh *m, struct behavior *b, int trianglebytes,
   unsigned long alignptr;
 
   /* Set up `dummytri', the `triangle' that occupies "outer space." */
-  m->dummytribase = (triangle *) trimalloc(trianglebytes +
-                                           m->triangles.alignbytes);
+  if (m->dummytribase == (triangle *) NULL) {
+    m->dummytribase = (triangle *) trimalloc(trianglebytes +
+                                             m->triangles.alignbytes);
+  }
   /* Align `dummytri' on a `triangles.alignbytes'-byte boundary. */
   alignptr = (unsigned long) m->dummytribase;
   m->dummytri = (triangle *)
@@ -1897,8 +1925,10 @@ void dummyinit(struct mesh *m, struct behavior *b, int trianglebytes,
     /* Set up `dummysub', the omnipresent subsegment pointed to by any */
     /*   triangle side or subsegment end that isn't attached to a real */
     /*   subsegment.                                                   */
-    m->dummysubbase = (subseg *) trimalloc(subsegbytes +
-                                           m->subsegs.alignbytes);
+    if (m->dummysubbase == (subseg *) NULL) {
+      m->dummysubbase = (subseg *) trimalloc(subsegbytes +
+                                             m->subsegs.alignbytes);
+    }
     /* Align `dummysub' on a `subsegs.alignbytes'-byte boundary. */
     alignptr = (unsigned long) m->dummysubbase;
     m->dummysub = (subseg *)
@@ -1959,7 +1989,7 @@ void initializevertexpool(struct mesh *m, struct behavior *b)
   }
 
   /* Initialize the pool of vertices. */
-  poolinit(&m->vertices, vertexsize, VERTEXPERBLOCK,
+  poolreinit(&m->vertices, vertexsize, VERTEXPERBLOCK,
            m->invertices > VERTEXPERBLOCK ? m->invertices : VERTEXPERBLOCK,
            sizeof(float));
 }
@@ -2011,14 +2041,14 @@ void initializetrisubpools(struct mesh *m, struct behavior *b)
   }
 
   /* Having determined the memory size of a triangle, initialize the pool. */
-  poolinit(&m->triangles, trisize, TRIPERBLOCK,
+  poolreinit(&m->triangles, trisize, TRIPERBLOCK,
            (2 * m->invertices - 2) > TRIPERBLOCK ? (2 * m->invertices - 2) :
            TRIPERBLOCK, 4);
 
   if (b->usesegments) {
     /* Initialize the pool of subsegments.  Take into account all eight */
     /*   pointers and one boundary marker.                              */
-    poolinit(&m->subsegs, 8 * sizeof(triangle) + sizeof(int),
+    poolreinit(&m->subsegs, 8 * sizeof(triangle) + sizeof(int),
              SUBSEGPERBLOCK, SUBSEGPERBLOCK, 4);
 
     /* Initialize the "outer space" triangle and omnipresent subsegment. */
@@ -2182,6 +2212,9 @@ void triangledeinit(struct mesh *m, struct behavior *b)
     trifree((int *) m->dummysubbase);
   }
   pooldeinit(&m->vertices);
+  if (m->sortarray != (vertex *) NULL) {
+    trifree((int *) m->sortarray);
+  }
 }
 
 /**                                                                         **/
@@ -4003,6 +4036,24 @@ void findcircumcenter(struct mesh *m, struct behavior *b,
 /**                                                                         **/
 /********* Geometric primitives end here                             *********/
 
+/*****************************************************************************/
+/*                                                                           */
+/*  trianglerestart()   Reset the per-triangulation variables.               */
+/*                                                                           */
+/*****************************************************************************/
+
+void trianglerestart(struct mesh *m)
+{
+  m->recenttri.tri = (triangle *) NULL; /* No triangle has been visited yet. */
+  m->undeads = 0;                       /* No eliminated input vertices yet. */
+  m->samples = 1;         /* Point location should take at least one sample. */
+  m->checksegments = 0;   /* There are no segments in the triangulation yet. */
+  m->checkquality = 0;     /* The quality triangulation stage has not begun. */
+  m->incirclecount = m->counterclockcount = m->orient3dcount = 0;
+  m->hyperbolacount = m->circletopcount = m->circumcentercount = 0;
+  randomseed = 1;
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /*  triangleinit()   Initialize some variables.                              */
@@ -4019,15 +4070,12 @@ void triangleinit(struct mesh *m)
   poolzero(&m->badtriangles);
   poolzero(&m->flipstackers);
   poolzero(&m->splaynodes);
+  m->dummytribase = (triangle *) NULL;
+  m->dummysubbase = (subseg *) NULL;
+  m->sortarray = (vertex *) NULL;
+  m->sortarraysize = 0;
 
-  m->recenttri.tri = (triangle *) NULL; /* No triangle has been visited yet. */
-  m->undeads = 0;                       /* No eliminated input vertices yet. */
-  m->samples = 1;         /* Point location should take at least one sample. */
-  m->checksegments = 0;   /* There are no segments in the triangulation yet. */
-  m->checkquality = 0;     /* The quality triangulation stage has not begun. */
-  m->incirclecount = m->counterclockcount = m->orient3dcount = 0;
-  m->hyperbolacount = m->circletopcount = m->circumcentercount = 0;
-  randomseed = 1;
+  trianglerestart(m);
 
   exactinit();                     /* Initialize exact arithmetic constants. */
 }
@@ -6168,8 +6216,16 @@ long divconqdelaunay(struct mesh *m, struct behavior *b)
     printf("  Sorting vertices.\n");
   }
 
-  /* Allocate an array of pointers to vertices for sorting. */
-  sortarray = (vertex *) trimalloc(m->invertices * (int) sizeof(vertex));
+  /* Allocate an array of pointers to vertices for sorting (kept in the */
+  /*   mesh so that a triangulatecontext can reuse it).                 */
+  if (m->sortarraysize < m->invertices) {
+    if (m->sortarray != (vertex *) NULL) {
+      trifree((int *) m->sortarray);
+    }
+    m->sortarray = (vertex *) trimalloc(m->invertices * (int) sizeof(vertex));
+    m->sortarraysize = m->invertices;
+  }
+  sortarray = m->sortarray;
   traversalinit(&m->vertices);
   for (i = 0; i < m->invertices; i++) {
     sortarray[i] = vertextraverse(m);
@@ -6211,7 +6267,6 @@ long divconqdelaunay(struct mesh *m, struct behavior *b)
 
   /* Form the Delaunay triangulation. */
   divconqrecurse(m, b, sortarray, i, 0, &hullleft, &hullright);
-  trifree((int *) sortarray);
 
   return removeghosts(m, b, &hullleft);
 }
@@ -8633,3 +8688,98 @@ void triangulate(char *triswitches, struct triangulateio *in,
 
   triangledeinit(&m, &b);
 }
+
+/*****************************************************************************/
+/*                                                                           */
+/*  triangulatecontext   Persistent state for repeated triangulations.       */
+/*                                                                           */
+/*  Keeps the mesh with its memory pools, the input point buffer and the     */
+/*  output triangle list alive between calls of triangulatecontextrun(), so  */
+/*  that once the buffers have grown to the working size, triangulating a    */
+/*  new point set does not allocate any memory.                              */
+/*                                                                           */
+/*****************************************************************************/
+
+struct triangulatecontext {
+  struct mesh m;
+  struct behavior b;
+  float *pointlist;
+  int pointcapacity;
+  int *trianglelist;
+  long trianglecapacity;
+};
+
+struct triangulatecontext *triangulatecontextnew(char *triswitches)
+{
+  struct triangulatecontext *ctx;
+
+  ctx = (struct triangulatecontext *)
+    trimalloc((int) sizeof(struct triangulatecontext));
+  triangleinit(&ctx->m);
+  parsecommandline(1, &triswitches, &ctx->b);
+  ctx->pointlist = (float *) NULL;
+  ctx->pointcapacity = 0;
+  ctx->trianglelist = (int *) NULL;
+  ctx->trianglecapacity = 0;
+  return ctx;
+}
+
+void triangulatecontextdelete(struct triangulatecontext *ctx)
+{
+  if (ctx == (struct triangulatecontext *) NULL) {
+    return;
+  }
+  triangledeinit(&ctx->m, &ctx->b);
+  trifree((int *) ctx->pointlist);
+  trifree(ctx->trianglelist);
+  trifree((int *) ctx);
+}
+
+float *triangulatecontextpoints(struct triangulatecontext *ctx,
+                                int numberofpoints)
+{
+  if (ctx->pointcapacity < numberofpoints) {
+    trifree((int *) ctx->pointlist);
+    ctx->pointlist = (float *)
+      trimalloc((int) (numberofpoints * 2 * sizeof(float)));
+    ctx->pointcapacity = numberofpoints;
+  }
+  return ctx->pointlist;
+}
+
+int triangulatecontextrun(struct triangulatecontext *ctx, int numberofpoints,
+                          int **trianglelist)
+{
+  struct mesh *m = &ctx->m;
+  struct behavior *b = &ctx->b;
+  float *talist = (float *) NULL;
+  long corners;
+
+  trianglerestart(m);
+  m->steinerleft = b->steiner;
+
+  /* Same steps as triangulate() for a plain Delaunay triangulation, but */
+  /*   the pools are restarted instead of being rebuilt.                 */
+  transfernodes(m, b, ctx->pointlist, (float *) NULL, (int *) NULL,
+                numberofpoints, 0);
+  m->hullsize = delaunay(m, b);
+  m->infvertex1 = (vertex) NULL;
+  m->infvertex2 = (vertex) NULL;
+  m->infvertex3 = (vertex) NULL;
+  m->holes = 0;
+  m->regions = 0;
+  m->edges = (3l * m->triangles.items + m->hullsize) / 2l;
+
+  /* Number the vertices and write the triangles into the kept buffer. */
+  numbernodes(m, b);
+  corners = m->triangles.items * ((b->order + 1) * (b->order + 2) / 2);
+  if (ctx->trianglecapacity < corners) {
+    trifree(ctx->trianglelist);
+    ctx->trianglelist = (int *) trimalloc((int) (corners * sizeof(int)));
+    ctx->trianglecapacity = corners;
+  }
+  writeelements(m, b, &ctx->trianglelist, &talist);
+
+  *trianglelist = ctx->trianglelist;
+  return (int) m->triangles.items;
+}